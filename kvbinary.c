@@ -0,0 +1,154 @@
+/*
+ * kvbinary.c - validator for binary serialized KeyValues
+ *
+ * Copyright (c) 2015-2016 Sam Heybey
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "kvbinary.h"
+
+static const char* skipstring(const char* p, const char* end) {
+	const char* terminator = memchr(p, '\0', (size_t)(end - p));
+	return terminator == NULL ? NULL : terminator + 1;
+}
+
+static const char* skipwstring(const char* p, const char* end) {
+	for (; end - p >= 2; p += 2) {
+		if (p[0] == '\0' && p[1] == '\0') {
+			return p + 2;
+		}
+	}
+	return NULL;
+}
+
+static size_t valuesize(unsigned char tag) {
+	switch (tag) {
+		case BINARYINT:
+		case BINARYFLOAT:
+		case BINARYPTR:
+		case BINARYCOLOR:
+			return 4;
+		case BINARYUINT64:
+		case BINARYINT64:
+			return 8;
+		default:
+			return 0;
+	}
+}
+
+void kvbinarycheck(const char* data, size_t length, kvbinaryresult* result) {
+	const char* p = data;
+	const char* end = data + length;
+	//start of each open subkey, to point at the one left unclosed
+	uint64_t sections[MAX_BINARY_DEPTH];
+	int depth = 0;
+
+	result->error = NULL;
+	result->offset = 0;
+	result->nodes = 0;
+	result->depth = 0;
+
+	for (;;) {
+		const char* node = p;
+		const char* next;
+		unsigned char tag;
+
+		if (p == end) {
+			if (depth > 0) {
+				result->error = "unclosed subkey";
+				result->offset = sections[depth - 1];
+			} else {
+				result->error = "missing end of root";
+				result->offset = length;
+			}
+			return;
+		}
+		tag = (unsigned char)*p++;
+		if (tag == BINARYEND || tag == BINARYNUMTYPES) {
+			if (depth == 0) {
+				break;
+			}
+			depth--;
+			continue;
+		}
+		if (tag > BINARYNUMTYPES || tag == BINARYEND + 1) {
+			result->error = "invalid type tag";
+			result->offset = (uint64_t)(node - data);
+			return;
+		}
+
+		next = skipstring(p, end);
+		if (next == NULL) {
+			result->error = "unterminated key name";
+			result->offset = (uint64_t)(node - data);
+			return;
+		}
+		p = next;
+		result->nodes++;
+
+		switch (tag) {
+			case BINARYSUBKEY:
+				if (depth == MAX_BINARY_DEPTH) {
+					result->error = "subkeys nested too deeply";
+					result->offset = (uint64_t)(node - data);
+					return;
+				}
+				sections[depth++] = (uint64_t)(node - data);
+				if (depth > result->depth) {
+					result->depth = depth;
+				}
+				break;
+			case BINARYSTRING:
+				next = skipstring(p, end);
+				if (next == NULL) {
+					result->error = "unterminated string value";
+					result->offset = (uint64_t)(node - data);
+					return;
+				}
+				p = next;
+				break;
+			case BINARYWSTRING:
+				next = skipwstring(p, end);
+				if (next == NULL) {
+					result->error = "unterminated wide string value";
+					result->offset = (uint64_t)(node - data);
+					return;
+				}
+				p = next;
+				break;
+			default:
+				if ((size_t)(end - p) < valuesize(tag)) {
+					result->error = "truncated value";
+					result->offset = (uint64_t)(node - data);
+					return;
+				}
+				p += valuesize(tag);
+				break;
+		}
+	}
+
+	if (p != end) {
+		result->error = "unexpected data after end of root";
+		result->offset = (uint64_t)(p - data);
+	}
+}
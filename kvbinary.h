@@ -0,0 +1,68 @@
+/*
+ * kvbinary.h - validator for binary serialized KeyValues
+ *
+ * Copyright (c) 2015-2016 Sam Heybey
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef KVBINARY_H
+#define KVBINARY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * node type tags of binary KeyValues. every node is a tag byte, a nul
+ * terminated name and a value; a subkey holds nodes up to an end tag, and
+ * the root level is closed by one as well. Steam files end subkeys with 8,
+ * KeyValues::WriteAsBinary ends them with TYPE_NUMTYPES, which is 11.
+ */
+typedef enum {
+	BINARYSUBKEY = 0,
+	BINARYSTRING = 1,  //nul terminated
+	BINARYINT = 2,     //4 bytes
+	BINARYFLOAT = 3,   //4 bytes
+	BINARYPTR = 4,     //4 bytes
+	BINARYWSTRING = 5, //16 bit units terminated by a zero unit
+	BINARYCOLOR = 6,   //4 bytes
+	BINARYUINT64 = 7,  //8 bytes
+	BINARYEND = 8,
+	BINARYINT64 = 10,  //8 bytes
+	BINARYNUMTYPES = 11
+} kvbinarytag;
+
+//loaders read subkeys recursively, so deeper files are rejected
+#define MAX_BINARY_DEPTH 256
+
+typedef struct {
+	const char* error; //NULL when the data is valid
+	uint64_t offset;   //offset of the node or byte the error refers to
+	uint64_t nodes;
+	int depth;         //deepest nesting seen
+} kvbinaryresult;
+
+/*
+ * walk the data without copying or allocating and stop at the first
+ * problem, since nothing after a bad tag or length can be trusted
+ */
+void kvbinarycheck(const char* data, size_t length, kvbinaryresult* result);
+
+#endif
@@ -0,0 +1,374 @@
+/*
+ * kvdecompress.c - streaming decompression of gzip, zstd and xz input
+ *
+ * Copyright (c) 2015-2016 Sam Heybey
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef KVLINT_ZLIB
+#include <zlib.h>
+#endif
+#ifdef KVLINT_ZSTD
+#include <zstd.h>
+#endif
+#ifdef KVLINT_LZMA
+#include <lzma.h>
+#endif
+
+#include "kvdecompress.h"
+#include "kvthread.h"
+
+#define DECOMPRESS_CHUNK_SIZE 65536
+#define DECOMPRESS_BUFFERS 4
+//zlib counts input in 32 bit integers, so large files are fed in slices
+#define ZLIB_SLICE 0x40000000
+
+typedef struct {
+	kvcompression compression;
+	//input not yet handed to the library
+	const char* data;
+	size_t remaining;
+#ifdef KVLINT_ZLIB
+	z_stream gzip;
+#endif
+#ifdef KVLINT_ZSTD
+	ZSTD_DStream* zstd;
+	ZSTD_inBuffer zstdin;
+	size_t zstdhint;
+#endif
+#ifdef KVLINT_LZMA
+	lzma_stream xz;
+#endif
+} decoder;
+
+/*
+ * ring of buffers between the decompressing thread and the consumer
+ */
+typedef struct {
+	decoder decoder;
+	char* buffers;
+	size_t lengths[DECOMPRESS_BUFFERS];
+	unsigned produced;
+	unsigned consumed;
+	bool done;
+	bool stop;
+	const char* error;
+	kvmutex lock;
+	kvcond filled;
+	kvcond emptied;
+} pipeline;
+
+kvcompression kvdetect(const char* data, size_t length) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	if (length >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b) {
+		return COMPRESSIONGZIP;
+	}
+	if (length >= 4 && bytes[0] == 0x28 && bytes[1] == 0xb5 && bytes[2] == 0x2f && bytes[3] == 0xfd) {
+		return COMPRESSIONZSTD;
+	}
+	if (length >= 6 && memcmp(bytes, "\xfd" "7zXZ\0", 6) == 0) {
+		return COMPRESSIONXZ;
+	}
+	return COMPRESSIONNONE;
+}
+
+const char* kvcompressionname(kvcompression compression) {
+	switch (compression) {
+		case COMPRESSIONGZIP:
+			return "gzip";
+		case COMPRESSIONZSTD:
+			return "zstd";
+		case COMPRESSIONXZ:
+			return "xz";
+		default:
+			return "uncompressed";
+	}
+}
+
+static const char* decoderinit(decoder* d, kvcompression compression, const char* data, size_t length) {
+	memset(d, 0, sizeof(*d));
+	d->compression = compression;
+	d->data = data;
+	d->remaining = length;
+	switch (compression) {
+#ifdef KVLINT_ZLIB
+		case COMPRESSIONGZIP:
+			//15 window bits plus 32 to expect a gzip header
+			if (inflateInit2(&d->gzip, 15 + 32) != Z_OK) {
+				return "unable to initialize gzip decompression";
+			}
+			return NULL;
+#endif
+#ifdef KVLINT_ZSTD
+		case COMPRESSIONZSTD:
+			d->zstd = ZSTD_createDStream();
+			if (d->zstd == NULL || ZSTD_isError(ZSTD_initDStream(d->zstd))) {
+				return "unable to initialize zstd decompression";
+			}
+			d->zstdin.src = data;
+			d->zstdin.size = length;
+			d->zstdin.pos = 0;
+			d->zstdhint = 1;
+			return NULL;
+#endif
+#ifdef KVLINT_LZMA
+		case COMPRESSIONXZ:
+			if (lzma_stream_decoder(&d->xz, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+				return "unable to initialize xz decompression";
+			}
+			d->xz.next_in = (const uint8_t*)data;
+			d->xz.avail_in = length;
+			return NULL;
+#endif
+		default:
+			d->compression = COMPRESSIONNONE;
+			return "support for this compression format is not compiled in";
+	}
+}
+
+static void decoderend(decoder* d) {
+	switch (d->compression) {
+#ifdef KVLINT_ZLIB
+		case COMPRESSIONGZIP:
+			inflateEnd(&d->gzip);
+			break;
+#endif
+#ifdef KVLINT_ZSTD
+		case COMPRESSIONZSTD:
+			ZSTD_freeDStream(d->zstd);
+			break;
+#endif
+#ifdef KVLINT_LZMA
+		case COMPRESSIONXZ:
+			lzma_end(&d->xz);
+			break;
+#endif
+		default:
+			break;
+	}
+}
+
+/*
+ * fill output with up to capacity bytes. finished is set once the end of
+ * the last stream has been reached.
+ */
+static const char* decode(decoder* d, char* output, size_t capacity, size_t* length, bool* finished) {
+	*length = 0;
+	switch (d->compression) {
+#ifdef KVLINT_ZLIB
+		case COMPRESSIONGZIP:
+			d->gzip.next_out = (Bytef*)output;
+			d->gzip.avail_out = (uInt)capacity;
+			while (d->gzip.avail_out > 0) {
+				int result;
+				if (d->gzip.avail_in == 0 && d->remaining > 0) {
+					uInt slice = d->remaining > ZLIB_SLICE ? ZLIB_SLICE : (uInt)d->remaining;
+					d->gzip.next_in = (Bytef*)d->data;
+					d->gzip.avail_in = slice;
+					d->data += slice;
+					d->remaining -= slice;
+				}
+				result = inflate(&d->gzip, Z_NO_FLUSH);
+				if (result == Z_STREAM_END) {
+					if (d->gzip.avail_in == 0 && d->remaining == 0) {
+						*finished = true;
+						break;
+					}
+					//another gzip member follows
+					inflateReset(&d->gzip);
+				} else if (result == Z_BUF_ERROR) {
+					return "truncated gzip data";
+				} else if (result != Z_OK) {
+					return "corrupt gzip data";
+				}
+			}
+			*length = capacity - d->gzip.avail_out;
+			return NULL;
+#endif
+#ifdef KVLINT_ZSTD
+		case COMPRESSIONZSTD: {
+			ZSTD_outBuffer out;
+			out.dst = output;
+			out.size = capacity;
+			out.pos = 0;
+			while (out.pos < out.size) {
+				size_t before = out.pos;
+				//a hint of zero means a frame ended and everything was flushed
+				if (d->zstdin.pos == d->zstdin.size && d->zstdhint == 0) {
+					*finished = true;
+					break;
+				}
+				d->zstdhint = ZSTD_decompressStream(d->zstd, &out, &d->zstdin);
+				if (ZSTD_isError(d->zstdhint)) {
+					return "corrupt zstd data";
+				}
+				if (d->zstdin.pos == d->zstdin.size && out.pos == before && d->zstdhint != 0) {
+					return "truncated zstd data";
+				}
+			}
+			*length = out.pos;
+			return NULL;
+		}
+#endif
+#ifdef KVLINT_LZMA
+		case COMPRESSIONXZ:
+			d->xz.next_out = (uint8_t*)output;
+			d->xz.avail_out = capacity;
+			while (d->xz.avail_out > 0) {
+				lzma_ret result = lzma_code(&d->xz, d->xz.avail_in == 0 ? LZMA_FINISH : LZMA_RUN);
+				if (result == LZMA_STREAM_END) {
+					*finished = true;
+					break;
+				} else if (result == LZMA_BUF_ERROR) {
+					return "truncated xz data";
+				} else if (result != LZMA_OK) {
+					return "corrupt xz data";
+				}
+			}
+			*length = capacity - d->xz.avail_out;
+			return NULL;
+#endif
+		default:
+			(void)output;
+			(void)capacity;
+			*finished = true;
+			return NULL;
+	}
+}
+
+static kvthreadresult KVTHREADCALL producer(void* argument) {
+	pipeline* p = argument;
+	const char* error = NULL;
+	bool finished = false;
+	while (error == NULL && !finished) {
+		char* buffer;
+		size_t length;
+		unsigned slot;
+		mutexlock(&p->lock);
+		while (p->produced - p->consumed == DECOMPRESS_BUFFERS && !p->stop) {
+			condwait(&p->emptied, &p->lock);
+		}
+		if (p->stop) {
+			mutexunlock(&p->lock);
+			break;
+		}
+		slot = p->produced % DECOMPRESS_BUFFERS;
+		buffer = p->buffers + slot * DECOMPRESS_CHUNK_SIZE;
+		mutexunlock(&p->lock);
+
+		error = decode(&p->decoder, buffer, DECOMPRESS_CHUNK_SIZE, &length, &finished);
+		if (length > 0) {
+			mutexlock(&p->lock);
+			p->lengths[slot] = length;
+			p->produced++;
+			condsignal(&p->filled);
+			mutexunlock(&p->lock);
+		}
+	}
+	mutexlock(&p->lock);
+	p->error = error;
+	p->done = true;
+	condsignal(&p->filled);
+	mutexunlock(&p->lock);
+	return 0;
+}
+
+/*
+ * used when no thread can be started
+ */
+static const char* decompressinline(pipeline* p, kvchunkhandler handler, void* context) {
+	const char* error = NULL;
+	bool finished = false;
+	while (error == NULL && !finished) {
+		size_t length;
+		error = decode(&p->decoder, p->buffers, DECOMPRESS_CHUNK_SIZE, &length, &finished);
+		if (length > 0 && !handler(p->buffers, length, context)) {
+			return NULL;
+		}
+	}
+	return error;
+}
+
+const char* kvdecompress(kvcompression compression, const char* data, size_t length, kvchunkhandler handler, void* context) {
+	pipeline p;
+	kvthread thread;
+	const char* error;
+
+	memset(&p, 0, sizeof(p));
+	error = decoderinit(&p.decoder, compression, data, length);
+	if (error != NULL) {
+		decoderend(&p.decoder);
+		return error;
+	}
+	p.buffers = malloc(DECOMPRESS_BUFFERS * DECOMPRESS_CHUNK_SIZE);
+	if (p.buffers == NULL) {
+		decoderend(&p.decoder);
+		return "unable to allocate memory for decompression";
+	}
+	mutexinit(&p.lock);
+	condinit(&p.filled);
+	condinit(&p.emptied);
+
+	if (!threadstart(&thread, producer, &p)) {
+		error = decompressinline(&p, handler, context);
+	} else {
+		for (;;) {
+			const char* buffer;
+			size_t chunklength;
+			bool keepgoing;
+			mutexlock(&p.lock);
+			while (p.consumed == p.produced && !p.done) {
+				condwait(&p.filled, &p.lock);
+			}
+			if (p.consumed == p.produced) {
+				mutexunlock(&p.lock);
+				break;
+			}
+			buffer = p.buffers + (p.consumed % DECOMPRESS_BUFFERS) * DECOMPRESS_CHUNK_SIZE;
+			chunklength = p.lengths[p.consumed % DECOMPRESS_BUFFERS];
+			mutexunlock(&p.lock);
+
+			keepgoing = handler(buffer, chunklength, context);
+
+			mutexlock(&p.lock);
+			p.consumed++;
+			if (!keepgoing) {
+				p.stop = true;
+			}
+			condsignal(&p.emptied);
+			mutexunlock(&p.lock);
+			if (!keepgoing) {
+				break;
+			}
+		}
+		threadjoin(thread);
+		error = p.stop ? NULL : p.error;
+	}
+
+	conddestroy(&p.filled);
+	conddestroy(&p.emptied);
+	mutexdestroy(&p.lock);
+	free(p.buffers);
+	decoderend(&p.decoder);
+	return error;
+}
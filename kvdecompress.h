@@ -0,0 +1,59 @@
+/*
+ * kvdecompress.h - streaming decompression of gzip, zstd and xz input
+ *
+ * Copyright (c) 2015-2016 Sam Heybey
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef KVDECOMPRESS_H
+#define KVDECOMPRESS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * each format is only decoded when kvlint is built with the matching
+ * KVLINT_ZLIB, KVLINT_ZSTD or KVLINT_LZMA define and library
+ */
+typedef enum {
+	COMPRESSIONNONE, COMPRESSIONGZIP, COMPRESSIONZSTD, COMPRESSIONXZ
+} kvcompression;
+
+/*
+ * return false to stop decompressing
+ */
+typedef bool (*kvchunkhandler)(const char* data, size_t length, void* context);
+
+/*
+ * identify the format from the magic bytes at the start of the data
+ */
+kvcompression kvdetect(const char* data, size_t length);
+
+const char* kvcompressionname(kvcompression compression);
+
+/*
+ * decompress on a second thread while handler consumes the output on this
+ * one, through a small ring of fixed size buffers. returns NULL when the
+ * data was decompressed completely or the handler stopped, otherwise a
+ * message describing the problem.
+ */
+const char* kvdecompress(kvcompression compression, const char* data, size_t length, kvchunkhandler handler, void* context);
+
+#endif
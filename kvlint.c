@@ -25,9 +25,19 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
 #include <sys/stat.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "kvparse.h"
+#include "kvthread.h"
+#include "kvdecompress.h"
+#include "kvbinary.h"
+#include "kvtree.h"
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -92,25 +102,28 @@ int getopt(int nargc, const char** nargv, const char* ostr) {
 	}
 	return optopt;
 }
+#define fseek64 _fseeki64
 #else
 #include <unistd.h>
 #include <libgen.h>
-#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
 #define MAX_PATH PATH_MAX
+#define fseek64 fseeko
 #endif
 
-#define printerror(error) printf("error in %s (line %d): %s\n", argv[optind], linecount, error)
-#define MAX_STRING_LENGTH 1024
-
-typedef enum {
-	KEY, SUBKEY,
-	KEYSTRING, KEYSTRINGEND,
-	VALUESTRING, VALUESTRINGEND,
-	STRINGESCAPE,
-	SLASH, LINECOMMENT, BLOCKCOMMENT, BLOCKASTERISK,
-	CONDITIONAL, CONDITIONALEND,
-	ENDOFROOT
-} state;
+typedef struct {
+	bool requirequotes;
+	bool allowmultiline;
+	bool parseescapes;
+	bool ignoreshrug;
+	bool checkrootescapes;
+	bool blockcomments;
+	bool validatedirectives;
+	bool multipleroot;
+	int maxerrors; //0 for no limit
+} options;
 
 static int isfile(const char* filename) {
 	struct stat st;
@@ -120,680 +133,2066 @@ static int isfile(const char* filename) {
 	return 0;
 }
 
-int main(int argc, char** argv) {
-	int rcode = 0;
-
-#ifndef _WIN32
-	extern int optind;
+/*
+ * read-only view of an entire file. on POSIX this is an mmap, on windows a
+ * file mapping; empty files map to a NULL pointer with a size of zero.
+ */
+typedef struct {
+	const char* data;
+	uint64_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
 #endif
-	int opt;
-	bool die = false;
-
-	bool requirequotes = false;
-	bool allowmultiline = false;
-	bool parseescapes = false;
-	bool ignoreshrug = false;
-	bool checkrootescapes = true;
-	bool blockcomments = false;
-	bool validatedirectives = false;
-	bool multipleroot = false;
+} mappedfile;
 
-	while ((opt = getopt(argc, argv, "hqmeswbdr")) != -1) {
-		switch (opt) {
-			case 'q':
-				requirequotes = true;
-				break;
-			case 'm':
-				allowmultiline = true;
-				break;
-			case 'e':
-				parseescapes = true;
-				break;
-			case 's':
-				ignoreshrug = true;
-				break;
-			case 'w':
-				checkrootescapes = false;
-				break;
-			case 'b':
-				blockcomments = true;
-				break;
-			case 'd':
-				validatedirectives = true;
-				break;
-			case 'r':
-				multipleroot = true;
-				break;
-			case 'h':
-			case '?':
-				//getopt prints an error message
-				die = true;
-				break;
+static bool mapfile(const char* filename, mappedfile* mf) {
+	mf->data = NULL;
+	mf->size = 0;
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	mf->mapping = NULL;
+	//sharing delete access lets a new index be moved over one that is mapped
+	mf->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mf->file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	//pipes and devices have to be read instead
+	if (GetFileType(mf->file) != FILE_TYPE_DISK || !GetFileSizeEx(mf->file, &size)) {
+		CloseHandle(mf->file);
+		return false;
+	}
+	mf->size = (uint64_t)size.QuadPart;
+	if (mf->size > 0) {
+		mf->mapping = CreateFileMappingA(mf->file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mf->mapping == NULL) {
+			CloseHandle(mf->file);
+			return false;
+		}
+		mf->data = MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+		if (mf->data == NULL) {
+			CloseHandle(mf->mapping);
+			CloseHandle(mf->file);
+			return false;
+		}
+	}
+#else
+	struct stat st;
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		return false;
+	}
+	//pipes and devices report a size of 0, they have to be read instead
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return false;
+	}
+	mf->size = (uint64_t)st.st_size;
+	if (mf->size > 0) {
+		void* data = mmap(NULL, (size_t)mf->size, PROT_READ, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return false;
 		}
+		mf->data = data;
 	}
+	//the mapping stays valid after the descriptor is closed
+	close(fd);
+#endif
+	return true;
+}
 
-	if (die || optind >= argc) {
-		printf("usage: %s -h | [-q] [-m] [-e [-s] [-w]] [-b] [-d] [-r] <filename> [...]\n", argv[0]);
-		printf("\t-h:\tshow usage message\n");
-		printf("\t-q:\trequire all keys and values to be quoted\n");
-		printf("\t-m:\tallow raw newlines in strings\n");
-		printf("\t-e:\tparse and validate escape sequences\n");
-		printf("\t-s:\tignore shrug emote when validating escape sequences\n");
-		printf("\t-w:\tignore invalid escape sequences in the first root key string\n");
-		printf("\t-b:\tallow block comments\n");
-		printf("\t-d:\tvalidate #base directives\n");
-		printf("\t-r:\tallow multiple root keys\n");
-		return 1;
+static void unmapfile(mappedfile* mf) {
+#ifdef _WIN32
+	if (mf->data != NULL) {
+		UnmapViewOfFile(mf->data);
+		CloseHandle(mf->mapping);
+	}
+	CloseHandle(mf->file);
+#else
+	if (mf->data != NULL) {
+		munmap((void*)mf->data, (size_t)mf->size);
 	}
+#endif
+	mf->data = NULL;
+	mf->size = 0;
+}
 
-	for (; optind < argc; optind++) {
+/*
+ * sidecar index (<file>.kvi) mapping key paths to byte spans in the file.
+ * the layout is a header, an array of entries and finally a pool holding
+ * each key name once. entries are stored breadth first: the root keys come
+ * first and the children of every subkey follow as one run, so a path is
+ * looked up one name at a time with a binary search per level. a key with
+ * a value maps to the value without its quotes, a key with a subkey maps
+ * to the subkey including its braces.
+ */
+#define INDEX_MAGIC "KVI2"
+#define INDEX_SUFFIX ".kvi"
+#define INDEX_TEMP_SUFFIX ".tmp"
+#define INDEX_ROOT UINT32_MAX
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
 
-		FILE* kvfile;
-		char* abspath;
-		char* basedir;
+typedef struct {
+	char magic[4];
+	uint32_t options;
+	uint64_t filesize;
+	int64_t mtime; //in nanoseconds, like ctime
+	int64_t ctime;
+	uint64_t inode;
+	uint64_t hash; //FNV-1a of the first filesize bytes
+	uint32_t resumable; //nonzero if the file ended between root keys
+	int32_t linecount;
+	uint32_t endstate;
+	uint32_t count;
+	uint32_t rootcount;
+	uint32_t poolsize;
+} indexheader;
 
-		int bracecount = 0;
-		int linecount = 1;
-		int lastbserror = -1;
+typedef struct {
+	uint32_t nameoffset;
+	uint32_t namelength;
+	uint32_t firstchild; //entry number of the first child of a subkey, sorted by name
+	uint32_t childcount;
+	uint64_t valueoffset;
+	uint64_t valuelength;
+} indexentry;
 
-		int character;
+typedef struct {
+	//entries in file order, their children are filled in when the index is written
+	indexentry* entries;
+	uint32_t* parents; //INDEX_ROOT for root keys
+	size_t count;
+	size_t capacity;
+	size_t parentcapacity;
 
-		bool space = false;
-		bool quoted = false;
-		bool directive = false;
-		bool checkfile = false;
-		bool overflow = false;
+	char* pool;
+	size_t poolsize;
+	size_t poolcapacity;
 
-		char directivename[MAX_STRING_LENGTH] = "";
-		int directiveindex = 0;
+	//entry numbers plus one by name, so each name goes into the pool once
+	uint32_t* names;
+	size_t namecount;
+	size_t namecapacity;
 
-		char string[MAX_STRING_LENGTH] = "";
-		int stringindex = 0;
+	//name of the key waiting for its value
+	char* key;
+	size_t keylength;
+	size_t keycapacity;
+	bool haskey;
 
-		state prevstate;
-		state currentstate = KEY;
+	//entry numbers of the open subkeys
+	uint32_t* sections;
+	size_t depth;
+	size_t sectioncapacity;
 
-		kvfile = fopen(argv[optind], "r");
+	bool failed;
 
-		if (kvfile == NULL) {
-			printf("error: unable to open file %s\n", argv[optind]);
-			continue;
+	//end of the indexed data, where parsing picks up when data was appended
+	uint64_t start;
+	int linecount;
+	kvstate endstate;
+	uint64_t hash;
+} kvindex;
+
+typedef enum {
+	INDEXFULL, INDEXAPPEND, INDEXCURRENT
+} indexstatus;
+
+static const char* sortpool;
+static const indexentry* sortentries;
+
+static uint64_t fnv(uint64_t hash, const char* data, size_t length) {
+	size_t i;
+	for (i = 0; i < length; i++) {
+		hash = (hash ^ (unsigned char)data[i]) * FNV_PRIME;
+	}
+	return hash;
+}
+
+static bool reserve(void** buffer, size_t* capacity, size_t needed, size_t size) {
+	size_t newcapacity;
+	void* newbuffer;
+	if (needed <= *capacity) {
+		return true;
+	}
+	newcapacity = *capacity ? *capacity : 64;
+	while (newcapacity < needed) {
+		newcapacity *= 2;
+	}
+	newbuffer = realloc(*buffer, newcapacity * size);
+	if (newbuffer == NULL) {
+		return false;
+	}
+	*buffer = newbuffer;
+	*capacity = newcapacity;
+	return true;
+}
+
+static void indexfree(kvindex* index) {
+	free(index->entries);
+	free(index->parents);
+	free(index->pool);
+	free(index->names);
+	free(index->key);
+	free(index->sections);
+	memset(index, 0, sizeof(*index));
+}
+
+static uint32_t* indexnameslot(uint32_t* names, size_t capacity, const kvindex* index, const char* name, size_t length) {
+	size_t slot = (size_t)fnv(FNV_OFFSET, name, length) & (capacity - 1);
+	while (names[slot] != 0) {
+		const indexentry* entry = &index->entries[names[slot] - 1];
+		if (entry->namelength == length && memcmp(index->pool + entry->nameoffset, name, length) == 0) {
+			break;
 		}
+		slot = (slot + 1) & (capacity - 1);
+	}
+	return &names[slot];
+}
 
-		if (validatedirectives) {
-#ifdef _WIN32
-			abspath = _fullpath(NULL, argv[optind], MAX_PATH);
-			if (abspath == NULL) {
-				printf("unable to resolve full path, not validating directives\n");
-				validatedirectives = false;
-				rcode = 1;
-			} else {
-				basedir = malloc(_MAX_DRIVE + _MAX_DIR * sizeof(char));
-				if (basedir == NULL) {
-					printf("unable to allocate memory for base directory, not validating directives\n");
-					free(abspath);
-					validatedirectives = false;
-					rcode = 1;
-				} else {
-					basedir[0] = '\0';
-					char drive[_MAX_DRIVE];
-					char path[_MAX_DIR];
-					_splitpath_s(abspath, drive, _MAX_DRIVE, path, _MAX_DIR, NULL, 0, NULL, 0);
-					strcat_s(basedir, _MAX_DRIVE + _MAX_DIR, drive);
-					strcat_s(basedir, _MAX_DRIVE + _MAX_DIR, path);
-				}
+/*
+ * find a name in the pool, adding it if it is new. the table is kept at
+ * most half full.
+ */
+static bool indexname(kvindex* index, const char* name, size_t length, uint32_t* offset) {
+	uint32_t* slot;
+	if ((index->namecount + 1) * 2 > index->namecapacity) {
+		size_t capacity = index->namecapacity == 0 ? 1024 : index->namecapacity * 2;
+		uint32_t* names = calloc(capacity, sizeof(uint32_t));
+		size_t i;
+		if (names == NULL) {
+			return false;
+		}
+		for (i = 0; i < index->namecapacity; i++) {
+			if (index->names[i] != 0) {
+				const indexentry* entry = &index->entries[index->names[i] - 1];
+				*indexnameslot(names, capacity, index, index->pool + entry->nameoffset, entry->namelength) = index->names[i];
 			}
+		}
+		free(index->names);
+		index->names = names;
+		index->namecapacity = capacity;
+	}
+	slot = indexnameslot(index->names, index->namecapacity, index, name, length);
+	if (*slot != 0) {
+		*offset = index->entries[*slot - 1].nameoffset;
+		return true;
+	}
+	if (index->poolsize + length > UINT32_MAX || !reserve((void**)&index->pool, &index->poolcapacity, index->poolsize + length, 1)) {
+		return false;
+	}
+	memcpy(index->pool + index->poolsize, name, length);
+	*offset = (uint32_t)index->poolsize;
+	index->poolsize += length;
+	//the entry being added is the first one with this name
+	*slot = (uint32_t)index->count + 1;
+	index->namecount++;
+	return true;
+}
+
+static void indexadd(kvindex* index, const char* name, size_t length, uint32_t parent, uint64_t offset, uint64_t valuelength) {
+	indexentry* entry;
+	uint32_t nameoffset;
+	if (index->failed) {
+		return;
+	}
+	if (index->count >= INDEX_ROOT - 1 ||
+		!reserve((void**)&index->entries, &index->capacity, index->count + 1, sizeof(indexentry)) ||
+		!reserve((void**)&index->parents, &index->parentcapacity, index->count + 1, sizeof(uint32_t)) ||
+		!indexname(index, name, length, &nameoffset)) {
+		index->failed = true;
+		return;
+	}
+	entry = &index->entries[index->count];
+	entry->nameoffset = nameoffset;
+	entry->namelength = (uint32_t)length;
+	entry->firstchild = 0;
+	entry->childcount = 0;
+	entry->valueoffset = offset;
+	entry->valuelength = valuelength;
+	index->parents[index->count++] = parent;
+}
+
+static uint32_t indexparent(const kvindex* index) {
+	return index->depth > 0 ? index->sections[index->depth - 1] : INDEX_ROOT;
+}
+
+static void indexkey(kvindex* index, const char* key, size_t length) {
+	if (index->failed) {
+		return;
+	}
+	if (!reserve((void**)&index->key, &index->keycapacity, length + 1, 1)) {
+		index->failed = true;
+		return;
+	}
+	memcpy(index->key, key, length);
+	index->keylength = length;
+	index->haskey = true;
+}
+
+static void indexvalue(kvindex* index, uint64_t offset, uint64_t length) {
+	indexadd(index, index->key, index->keylength, indexparent(index), offset, length);
+	index->haskey = false;
+}
+
+static void indexopen(kvindex* index, uint64_t start) {
+	if (!index->haskey) {
+		//a subkey without a name
+		index->keylength = 0;
+	}
+	index->haskey = false;
+	//the length is filled in when the subkey is closed
+	indexadd(index, index->key, index->keylength, indexparent(index), start, 0);
+	if (index->failed) {
+		return;
+	}
+	if (!reserve((void**)&index->sections, &index->sectioncapacity, index->depth + 1, sizeof(uint32_t))) {
+		index->failed = true;
+		return;
+	}
+	index->sections[index->depth++] = (uint32_t)index->count - 1;
+}
+
+static void indexclose(kvindex* index, uint64_t end) {
+	indexentry* entry;
+	if (index->failed || index->depth == 0) {
+		return;
+	}
+	entry = &index->entries[index->sections[--index->depth]];
+	entry->valuelength = end - entry->valueoffset;
+	index->haskey = false;
+}
+
+static int comparepath(const char* a, size_t alength, const char* b, size_t blength) {
+	int result = memcmp(a, b, alength < blength ? alength : blength);
+	if (result != 0) {
+		return result;
+	}
+	return (alength > blength) - (alength < blength);
+}
+
+static int compareentries(const void* a, const void* b) {
+	const indexentry* ea = &sortentries[*(const uint32_t*)a];
+	const indexentry* eb = &sortentries[*(const uint32_t*)b];
+	int result = comparepath(sortpool + ea->nameoffset, ea->namelength, sortpool + eb->nameoffset, eb->namelength);
+	if (result != 0) {
+		return result;
+	}
+	//duplicate keys keep file order so lookups find the first one
+	return (ea->valueoffset > eb->valueoffset) - (ea->valueoffset < eb->valueoffset);
+}
+
+/*
+ * put the entries in the order they are written: breadth first, with the
+ * children of each subkey sorted by name. returns a malloced array.
+ */
+static indexentry* indexorder(kvindex* index, uint32_t* rootcount) {
+	size_t count = index->count;
+	size_t* ends = calloc(count + 1, sizeof(size_t));
+	uint32_t* children = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+	uint32_t* order = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+	indexentry* result = malloc((count > 0 ? count : 1) * sizeof(indexentry));
+	size_t used;
+	size_t i;
+	if (ends == NULL || children == NULL || order == NULL || result == NULL) {
+		free(ends);
+		free(children);
+		free(order);
+		free(result);
+		return NULL;
+	}
+	//group the children of each entry, root keys are group 0 and children of entry i are group i + 1
+	for (i = 0; i < count; i++) {
+		ends[index->parents[i] == INDEX_ROOT ? 0 : index->parents[i] + 1]++;
+	}
+	for (i = 1; i <= count; i++) {
+		ends[i] += ends[i - 1];
+	}
+	for (i = count; i > 0; i--) {
+		size_t group = index->parents[i - 1] == INDEX_ROOT ? 0 : index->parents[i - 1] + 1;
+		children[--ends[group]] = (uint32_t)(i - 1);
+	}
+	//ends[group] is now where the group starts, and it ends where the next one starts
+	sortpool = index->pool;
+	sortentries = index->entries;
+	used = ends[1];
+	memcpy(order, children, used * sizeof(uint32_t));
+	qsort(order, used, sizeof(uint32_t), compareentries);
+	*rootcount = (uint32_t)used;
+	for (i = 0; i < used; i++) {
+		size_t group = order[i] + 1;
+		size_t start = ends[group];
+		size_t length = (group < count ? ends[group + 1] : count) - start;
+		result[i] = index->entries[order[i]];
+		if (length > 0) {
+			result[i].firstchild = (uint32_t)used;
+			result[i].childcount = (uint32_t)length;
+			memcpy(order + used, children + start, length * sizeof(uint32_t));
+			qsort(order + used, length, sizeof(uint32_t), compareentries);
+			used += length;
+		}
+	}
+	free(ends);
+	free(children);
+	free(order);
+	return result;
+}
+
+static void indextimes(const struct stat* st, int64_t* mtime, int64_t* ctime) {
+#if defined(_WIN32)
+	*mtime = (int64_t)st->st_mtime * 1000000000;
+	*ctime = (int64_t)st->st_ctime * 1000000000;
+#elif defined(__APPLE__)
+	*mtime = (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+	*ctime = (int64_t)st->st_ctimespec.tv_sec * 1000000000 + st->st_ctimespec.tv_nsec;
 #else
-			abspath = realpath(argv[optind], NULL);
-			if (abspath == NULL) {
-				printf("unable to resolve full path, not validating directives\n");
-				validatedirectives = false;
-				rcode = 1;
+	*mtime = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+	*ctime = (int64_t)st->st_ctim.tv_sec * 1000000000 + st->st_ctim.tv_nsec;
+#endif
+}
+
+/*
+ * nanosecond times and the inode change whenever the file is written or
+ * replaced, so while they all match the contents do not need hashing
+ */
+static bool indexfresh(const indexheader* header, const struct stat* st) {
+	int64_t mtime;
+	int64_t ctime;
+	indextimes(st, &mtime, &ctime);
+	return header->filesize == (uint64_t)st->st_size && header->mtime == mtime && header->ctime == ctime &&
+		header->inode == (uint64_t)st->st_ino;
+}
+
+static uint32_t optionbits(const options* opts) {
+	return opts->requirequotes | opts->allowmultiline << 1 | opts->parseescapes << 2 |
+		opts->ignoreshrug << 3 | opts->checkrootescapes << 4 | opts->blockcomments << 5 |
+		opts->validatedirectives << 6 | opts->multipleroot << 7;
+}
+
+static char* indexfilename(const char* filename) {
+	char* name = malloc(strlen(filename) + sizeof(INDEX_SUFFIX));
+	if (name != NULL) {
+		strcpy(name, filename);
+		strcat(name, INDEX_SUFFIX);
+	}
+	return name;
+}
+
+/*
+ * returns the header of a mapped index if it is well formed, NULL otherwise
+ */
+static const indexheader* indexcheck(const mappedfile* mf) {
+	const indexheader* header = (const indexheader*)mf->data;
+	if (mf->size < sizeof(indexheader) || memcmp(header->magic, INDEX_MAGIC, 4) != 0) {
+		return NULL;
+	}
+	if (mf->size != sizeof(indexheader) + (uint64_t)header->count * sizeof(indexentry) + header->poolsize ||
+		header->rootcount > header->count) {
+		return NULL;
+	}
+	//entries are checked with entryvalid where they are read, so a lookup does not have to touch all of them
+	return header;
+}
+
+static bool entryvalid(const indexheader* header, const indexentry* entry) {
+	uint32_t number = (uint32_t)(entry - (const indexentry*)(header + 1));
+	//children always come after their subkey, which rules out loops
+	return (uint64_t)entry->nameoffset + entry->namelength <= header->poolsize &&
+		(entry->childcount == 0 || (entry->firstchild > number && (uint64_t)entry->firstchild + entry->childcount <= header->count));
+}
+
+/*
+ * whether the index describes the file as it is now. when only the times
+ * changed, the contents are hashed to make sure.
+ */
+static bool indexcurrent(const indexheader* header, const char* filename, const struct stat* st) {
+	mappedfile filemap;
+	bool current;
+	if (indexfresh(header, st)) {
+		return true;
+	}
+	if (header->filesize != (uint64_t)st->st_size || !mapfile(filename, &filemap)) {
+		return false;
+	}
+	current = filemap.size == header->filesize && fnv(FNV_OFFSET, filemap.data, (size_t)filemap.size) == header->hash;
+	unmapfile(&filemap);
+	return current;
+}
+
+/*
+ * decide how much of the file needs to be parsed to bring its index up to
+ * date. if the existing index covers an unchanged prefix of the file that
+ * ended between root keys, its entries are loaded and only the appended
+ * data is parsed. a file that was only touched is handled the same way,
+ * with nothing to parse, so its index gets the new times.
+ */
+static indexstatus indexprepare(const char* filename, const struct stat* st, const options* opts, kvindex* index) {
+	indexstatus status = INDEXFULL;
+	const indexheader* header;
+	mappedfile indexmap;
+	mappedfile filemap;
+	char* name = indexfilename(filename);
+	if (name == NULL || !mapfile(name, &indexmap)) {
+		free(name);
+		return INDEXFULL;
+	}
+	free(name);
+	header = indexcheck(&indexmap);
+	if (header == NULL || header->options != optionbits(opts)) {
+		unmapfile(&indexmap);
+		return INDEXFULL;
+	}
+	if (indexfresh(header, st)) {
+		unmapfile(&indexmap);
+		return INDEXCURRENT;
+	}
+	if (header->resumable && header->filesize <= (uint64_t)st->st_size && mapfile(filename, &filemap)) {
+		uint64_t hash = FNV_OFFSET;
+		if (filemap.size >= header->filesize) {
+			hash = fnv(hash, filemap.data, (size_t)header->filesize);
+		}
+		if (filemap.size >= header->filesize && hash == header->hash) {
+			const indexentry* entries = (const indexentry*)(header + 1);
+			const char* pool = (const char*)(entries + header->count);
+			uint32_t* parents = malloc((header->count > 0 ? header->count : 1) * sizeof(uint32_t));
+			uint32_t j;
+			uint32_t k;
+			if (parents == NULL) {
+				index->failed = true;
 			} else {
-				basedir = dirname(abspath);
-				if (basedir == NULL) {
-					printf("unable to determine base directory, not validating directives\n");
-					free(abspath);
-					validatedirectives = false;
-					rcode = 1;
+				for (j = 0; j < header->count; j++) {
+					parents[j] = INDEX_ROOT;
 				}
 			}
-#endif
-		}
-
-		while ((character = fgetc(kvfile)) != EOF) {
-			if (character == '\r') {
-				character = fgetc(kvfile);
-				if (character != '\n') {
-					printerror("unexpected carriage return, stopping");
-					fclose(kvfile);
-					rcode = 1;
+			//entries are loaded in the order they are stored, so their numbers stay the same
+			for (j = 0; j < header->count && !index->failed; j++) {
+				if (!entryvalid(header, &entries[j]) || (j >= header->rootcount && parents[j] == INDEX_ROOT)) {
+					index->failed = true;
 					break;
 				}
+				for (k = 0; k < entries[j].childcount; k++) {
+					parents[entries[j].firstchild + k] = j;
+				}
+				indexadd(index, pool + entries[j].nameoffset, entries[j].namelength, parents[j], entries[j].valueoffset, entries[j].valuelength);
 			}
-			if (character == '\n') {
-				//a newline will always increase the linecount regardless of errors
-				linecount++;
-			}
-			switch (currentstate) {
-				case KEY:
-					//newline, whitespace, close brace, string, or comment
-					switch (character) {
-						case '\n':
-						case '\t':
-						case ' ':
-							//no state change
-							break;
-						case '}':
-							if (--bracecount < 0) {
-								if (requirequotes) {
-									printerror("unexpected close brace");
-								} else {
-									printerror("unexpected close brace (you cannot use braces in unquoted strings)");
-								}
-								bracecount = 0;
-							}
-							if (bracecount == 0 && !multipleroot) {
-								currentstate = ENDOFROOT;
-							}
-							break;
-						case '{':
-							printerror("unexpected open brace (maybe you forgot to name a key)");
-							bracecount++;
-							break;
-						case '\'':
-							printerror("unexpected single quote (use double quotes instead)");
-							break;
-						case '"':
-							quoted = true;
-							currentstate = KEYSTRING;
-							break;
-						case '/':
-							prevstate = KEY;
-							currentstate = SLASH;
-							break;
-						case '[':
-							printerror("conditionals must be on the same line as the key they apply to");
-							break;
-						default:
-							if (requirequotes) { 
-								printerror("unexpected character (maybe you forgot to quote a string)");
-							} else {
-								quoted = false;
-								currentstate = KEYSTRING;
-							}
-							break;
-					}
-					break;
-				case SUBKEY:
-					//newline, whitespace, open brace, or comment
-					switch (character) {
-						case '\n':
-						case '\t':
-						case ' ':
-							//no state change
-							break;
-						case '{':
-							bracecount++;
-							currentstate = KEY;
-							break;
-						case '/':
-							prevstate = SUBKEY;
-							currentstate = SLASH;
-							break;
-						case '[':
-							printerror("conditionals must be on the same line as the key they apply to");
-							break;
-						default:
-							printerror("unexpected character (probably malformed or missing subkey)");
-							break;
-					}
-					break;
-				case KEYSTRING:
-					//anything except a newline
-					if (stringindex == 0) {
-						string[0] = '\0';
-						directivename[0] = '\0';
-						overflow = false;
-					}
-					if (stringindex == MAX_STRING_LENGTH) {
-						printerror("key string size limit exceeded");
-						string[MAX_STRING_LENGTH - 1] = '\0';
-						directivename[MAX_STRING_LENGTH - 1] = '\0';
-						overflow = true;
-					}
-					if (!overflow) {
-						string[stringindex] = character;
-						if (directive) {
-							directivename[directiveindex++] = character;
-						}
-					}
-					switch (character) {
-						case '\t':
-							if (quoted) {
-								if (parseescapes) {
-									printerror("unescaped tab in key string");
-								}
-							} else {
-								space = true;
-								currentstate = KEYSTRINGEND;
-							}
-							break;
-						case ' ':
-							if (!quoted) {
-								space = true;
-								currentstate = KEYSTRINGEND;
-							}
-							break;
-						case '\n':
-							if (quoted) {
-								if (!allowmultiline) {
-									printerror("unterminated key string");
-									currentstate = SUBKEY;
-								}
-							} else {
-								currentstate = SUBKEY;
-							}
-							break;
-						case '\\':
-							if (parseescapes) {
-								if (quoted) {
-									prevstate = KEYSTRING;
-									currentstate = STRINGESCAPE;
-								} else {
-									printerror("backslash in unquoted key string (should you be parsing escape sequences?)");
-								}
-							}
-							break;
-						case '"':
-							if (quoted) {
-								space = false;
-								currentstate = KEYSTRINGEND;
-							} else {
-								printerror("double-quote in unquoted key string");
-							}
-							break;
-						case '{':
-						case '}':
-							if (!quoted) {
-								printerror("unexpected brace in key string (you cannot use braces in unquoted strings)");
-							}
-							break;
-						case '#':
-							if (validatedirectives && stringindex == 0) {
-								directive = true;
-							}
-							break;
-						default:
-							//no state change
-							break;
-					}
-					if (currentstate == KEYSTRINGEND) {
-						if (!overflow) {
-							string[stringindex] = '\0';
-						}
-						stringindex = -1;
-						if (directive) {
-							directive = false;
-							if (!overflow) {
-								directivename[directiveindex - 1] = '\0';
-							}
-							directiveindex = 0;
-							if (strcmp(directivename, "base") == 0) {
-								checkfile = true;
-							}
-						}
-					}
-					stringindex++;
-					break;
-				case KEYSTRINGEND:
-					//newline, whitespace, string, comment, or conditional
-					switch (character) {
-						case '\n':
-							currentstate = SUBKEY;
-							break;
-						case '\t':
-						case ' ':
-							space = true;
-							break;
-						case '"':
-							if (!space) {
-								printerror("missing space between key and value strings");
-							}
-							quoted = true;
-							currentstate = VALUESTRING;
-							break;
-						case '/':
-							prevstate = KEYSTRINGEND;
-							currentstate = SLASH;
-							break;
-						case '[':
-							prevstate = KEYSTRINGEND;
-							currentstate = CONDITIONAL;
-							break;
-						case '{':
-							bracecount++;
-							currentstate = KEY;
-							printerror("braces should be on their own line, or quoted if they are part of a string");
-							break;
-						case '}':
-							printerror("unexpected close brace (possibly unquoted value string)");
-							break;
-						default:
-							if (requirequotes) {
-								printerror("unexpected character after key string (possibly unquoted value string)");
-							} else {
-								quoted = false;
-								currentstate = VALUESTRING;
-							}
-							break;
-					}
-					break;
-				case VALUESTRING:
-					//anything except a newline
-					if (stringindex == 0) {
-						string[0] = '\0';
-						overflow = false;
-					}
-					if (stringindex == MAX_STRING_LENGTH) {
-						printerror("value string size limit exceeded");
-						string[MAX_STRING_LENGTH - 1] = '\0';
-						overflow = true;
-					}
-					if (!overflow) {
-						string[stringindex] = character;
-					}
-					switch (character) {
-						case '\t':
-							if (quoted) {
-								if (!allowmultiline && parseescapes) {
-									printerror("unescaped tab in value string");
-								}
-							} else {
-								space = true;
-								currentstate = VALUESTRINGEND;
-							}
-							break;
-						case ' ':
-							if (!quoted) {
-								space = true;
-								currentstate = VALUESTRINGEND;
-							}
-							break;
-						case '\n':
-							if (quoted) {
-								if (!allowmultiline) {
-									printerror("unterminated value string");
-									currentstate = KEY;
-								}
-							} else {
-								currentstate = KEY;
-							}
-							break;
-						case '\\':
-							if (parseescapes) {
-								if (quoted) {
-									prevstate = VALUESTRING;
-									currentstate = STRINGESCAPE;
-								} else {
-									printerror("backslash in unquoted value string (should you be parsing escape sequences?)");
-								}
-							}
-							break;
-						case '"':
-							currentstate = VALUESTRINGEND;
-							break;
-						case '}':
-						case '{':
-							if (!quoted) {
-								printerror("unexpected brace in value string (you cannot use braces in unquoted strings)");
-							}
-							break;
-						default:
-							//no state change
-							break;
-					}
-					if (!overflow && currentstate == VALUESTRINGEND) {
-						string[stringindex] = '\0';
-					}
-					stringindex++;
-					break;
-				case VALUESTRINGEND:
-					//whitespace, newline, comment, or conditional
-					if (checkfile) {
-						checkfile = false;
+			free(parents);
+			index->start = header->filesize;
+			index->linecount = header->linecount;
+			index->endstate = (kvstate)header->endstate;
+			index->hash = hash;
+			status = index->failed ? INDEXFULL : INDEXAPPEND;
+		}
+		unmapfile(&filemap);
+	}
+	unmapfile(&indexmap);
+	if (status == INDEXFULL) {
+		indexfree(index);
+	}
+	return status;
+}
+
+static bool indexwrite(const char* filename, const struct stat* st, const options* opts, kvindex* index) {
+	indexheader header;
+	indexentry* entries;
+	uint32_t rootcount;
+	FILE* indexfile;
+	bool written;
+	char* tempname;
+	char* name = indexfilename(filename);
+	if (name == NULL) {
+		return false;
+	}
+	//other processes may have the old index mapped, so it is replaced rather than truncated.
+	//the process id keeps two writers from sharing a temporary file
+	tempname = malloc(strlen(name) + sizeof(INDEX_TEMP_SUFFIX) + 11);
+	entries = indexorder(index, &rootcount);
+	if (tempname == NULL || entries == NULL) {
+		free(entries);
+		free(tempname);
+		free(name);
+		return false;
+	}
 #ifdef _WIN32
-						if (strlen(string) > MAX_PATH - strlen(basedir) - 1) { //Windows adds a slash, POSIX does not
+	sprintf(tempname, "%s.%lu" INDEX_TEMP_SUFFIX, name, (unsigned long)GetCurrentProcessId());
 #else
-						if (strlen(string) > MAX_PATH - strlen(basedir) - 2) {
+	sprintf(tempname, "%s.%lu" INDEX_TEMP_SUFFIX, name, (unsigned long)getpid());
 #endif
-							printerror("included file path too long");
-						} else {
-							char path[MAX_PATH];
-							strcat(path, basedir);
-#ifndef _WIN32
-							strcat(path, "/");
-#endif
-							strcat(path, string);
-							if (!isfile(path)) {
-								printerror("unreadable included file");
-							}
-						}
-					}
-					switch (character) {
-						case '\t':
-						case ' ':
-							//no state change
-							break;
-						case '\n':
-							currentstate = KEY;
-							break;
-						case '/':
-							prevstate = VALUESTRINGEND;
-							currentstate = SLASH;
-							break;
-						case '[':
-							prevstate = VALUESTRINGEND;
-							currentstate = CONDITIONAL;
-							break;
-						default:
-							printerror("unexpected character after value string (maybe you forgot to use quotes)");
-							break;
-					}
-					break;
-				case STRINGESCAPE:
-					//backslash, t, n, quote, underscore
-					currentstate = prevstate;
-					switch (character) {
-						case '\\':
-						case 't':
-						case 'n':
-						case '"':
-							//no state change
-							break;
-						case '_':
-							if (ignoreshrug) {
-								break;
-							}
-							//else intentional fallthrough
-						default:
-							if (!(lastbserror == linecount)) {
-								lastbserror = linecount;
-								switch (prevstate) {
-									case KEYSTRING:
-										if (linecount != 1 || checkrootescapes) {
-											printerror("invalid escape sequence in key string");
-										}
-										break;
-									case VALUESTRING:
-										printerror("invalid escape sequence in value string");
-										break;
-									default:
-										printerror("you've found a bug in kvlint! please submit an issue on github with this error message and the file you're linting.");
-										break;
-								}
-							}
-							break;
-					}
-					break;
-				case SLASH:
-					//forward slash
-					switch (character) {
-						case '/':
-							currentstate = LINECOMMENT;
-							break;
-						case '*':
-							if (blockcomments) {
-								currentstate = BLOCKCOMMENT;
-							} else {
-								currentstate = LINECOMMENT;
-								printerror("only line comments are allowed. block comments act as line comments in most games and can cause unexpected behavior");
-							}
-							break;
-						default:
-							currentstate = LINECOMMENT;
-							printerror("bogus comment");
-							break;
-					}
-					break;
-				case LINECOMMENT:
-					//ignore the rest of the line
-					switch (character) {
-						case '\n':
-							switch (prevstate) {
-								case KEY:
-								case VALUESTRINGEND:
-									currentstate = KEY;
-									break;
-								case SUBKEY:
-								case KEYSTRINGEND:
-									currentstate = SUBKEY;
-									break;
-								case ENDOFROOT:
-									currentstate = ENDOFROOT;
-								default:
-									printerror("you've found a bug in kvlint! please submit an issue on github with this error message and the file you're linting.");
-									printerror("unexpected parser state in linecomment");
-									rcode = 1;
-									break;
-							}
-							break;
-						default:
-							//no state change
-							break;
-					}
-					break;
-				case BLOCKCOMMENT:
-					//ignore until */
-					switch (character) {
-						case '*':
-							currentstate = BLOCKASTERISK;
-							break;
-						default:
-							//no state change
-							break;
-					}
-					break;
-				case BLOCKASTERISK:
-					//asterisk in block comment
-					switch (character) {
-						case '*':
-							//no state change
-							break;
-						case '/':
-							currentstate = prevstate;
-							break;
-						default:
-							currentstate = BLOCKCOMMENT;
-							break;
-					}
-					break;
-				case CONDITIONAL:
-					//ignore until ]
-					switch (character) {
-						case '\n':
-							printerror("unterminated conditional");
-							switch (prevstate) {
-								case VALUESTRINGEND:
-									currentstate = KEY;
-									break;
-								case KEYSTRINGEND:
-									currentstate = SUBKEY;
-									break;
-								default:
-									printerror("you've found a bug in kvlint! please submit an issue on github with this error message and the file you're linting.");
-									printerror("unexpected parser state in conditional");
-									rcode = 1;
-									break;
-							}
-							break;
-						case ']':
-							currentstate = CONDITIONALEND;
-							break;
-					}
-					break;
-				case CONDITIONALEND:
-					//whitespace, newline, or comment
-					switch (character) {
-						case ' ':
-						case '\t':
-							//no state change
-							break;
-						case '\n':
-							switch (prevstate) {
-								case VALUESTRINGEND:
-									currentstate = KEY;
-									break;
-								case KEYSTRINGEND:
-									currentstate = SUBKEY;
-									break;
-								default:
-									printerror("you've found a bug in kvlint! please submit an issue on github with this error message and the file you're linting.");
-									printerror("unexpected parser state in conditionalend");
-									rcode = 1;
-									break;
-							}
-							break;
-						case '[':
-							printerror("only one conditional may be used per key");
-							break;
-						case '/':
-							currentstate = SLASH;
-							break;
-						default:
-							printerror("unexpected character after conditional");
-							break;
-					}
-					break;
-				case ENDOFROOT:
-					//whitespace, newline, or comment
-					switch (character) {
-						case ' ':
-						case '\t':
-						case '\n':
-							//no state change
-							break;
-						case '/':
-							currentstate = SLASH;
-							break;
-						default:
-							printerror("unexpected data after end of root key");
-							break;
-					}
-			}
-		}
-		if (validatedirectives) {
-			free(abspath);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, INDEX_MAGIC, 4);
+	header.options = optionbits(opts);
+	header.filesize = index->start;
+	indextimes(st, &header.mtime, &header.ctime);
+	header.inode = (uint64_t)st->st_ino;
+	header.hash = index->hash;
+	header.resumable = index->endstate == KVSTATEKEY || index->endstate == KVSTATEENDOFROOT;
+	header.linecount = index->linecount;
+	header.endstate = index->endstate;
+	header.count = (uint32_t)index->count;
+	header.rootcount = rootcount;
+	header.poolsize = (uint32_t)index->poolsize;
+
+	indexfile = fopen(tempname, "wb");
+	if (indexfile == NULL) {
+		free(entries);
+		free(tempname);
+		free(name);
+		return false;
+	}
+	written = fwrite(&header, sizeof(header), 1, indexfile) == 1 &&
+		fwrite(entries, sizeof(indexentry), index->count, indexfile) == index->count &&
+		fwrite(index->pool, 1, index->poolsize, indexfile) == index->poolsize;
+	written = fclose(indexfile) == 0 && written;
 #ifdef _WIN32
-			free(basedir);
+	written = written && MoveFileExA(tempname, name, MOVEFILE_REPLACE_EXISTING);
+#else
+	written = written && rename(tempname, name) == 0;
 #endif
+	if (!written) {
+		remove(tempname);
+	}
+	free(entries);
+	free(tempname);
+	free(name);
+	return written;
+}
+
+/*
+ * follow a key path one name at a time, taking the first key with each
+ * name like KeyValues::FindKey does
+ */
+static const indexentry* indexlookup(const indexheader* header, const char* path) {
+	const indexentry* entries = (const indexentry*)(header + 1);
+	const char* pool = (const char*)(entries + header->count);
+	const indexentry* found = NULL;
+	size_t first = 0;
+	size_t count = header->rootcount;
+	for (;;) {
+		const char* slash = strchr(path, '/');
+		size_t length = slash != NULL ? (size_t)(slash - path) : strlen(path);
+		size_t low = first;
+		size_t high = first + count;
+		while (low < high) {
+			size_t middle = low + (high - low) / 2;
+			if (!entryvalid(header, &entries[middle])) {
+				return NULL;
+			}
+			if (comparepath(pool + entries[middle].nameoffset, entries[middle].namelength, path, length) < 0) {
+				low = middle + 1;
+			} else {
+				high = middle;
+			}
 		}
-		fclose(kvfile);
-		if (bracecount > 0) {
-			printf("error in %s: unclosed key\n", argv[optind]);
+		if (low == first + count || !entryvalid(header, &entries[low]) ||
+			comparepath(pool + entries[low].nameoffset, entries[low].namelength, path, length) != 0) {
+			return NULL;
+		}
+		found = &entries[low];
+		if (slash == NULL) {
+			return found;
+		}
+		first = found->firstchild;
+		count = found->childcount;
+		path = slash + 1;
+	}
+}
+
+/*
+ * growable text, used to keep the output of files linted in parallel apart
+ */
+typedef struct {
+	char* data;
+	size_t length;
+	size_t capacity;
+} textbuffer;
+
+static void textappendv(textbuffer* text, const char* format, va_list args) {
+	va_list copy;
+	int length;
+	va_copy(copy, args);
+	length = vsnprintf(NULL, 0, format, copy);
+	va_end(copy);
+	if (length < 0 || !reserve((void**)&text->data, &text->capacity, text->length + length + 1, 1)) {
+		return;
+	}
+	vsnprintf(text->data + text->length, length + 1, format, args);
+	text->length += length;
+}
+
+/*
+ * project wide table of the colors, fonts and borders defined in scheme
+ * files and referenced everywhere else. names are case insensitive like in
+ * the game. the table is split into shards with their own locks so that
+ * threads only contend when they hit the same shard at the same time.
+ */
+#define SYMBOL_SHARDS 64
+#define SYMBOL_KEY_LENGTH 64
+
+typedef enum {
+	SYMBOLCOLOR, SYMBOLFONT, SYMBOLBORDER, SYMBOLNONE
+} symbolkind;
+
+static const char* symbolkinds[] = { "color", "font", "border" };
+
+typedef struct {
+	char* name;
+	uint64_t hash;
+	symbolkind kind;
+	int definitions;
+	int references;
+	//earliest definition and reference, by file order then line
+	int deffile;
+	int defline;
+	int reffile;
+	int refline;
+} symbol;
+
+typedef struct {
+	kvmutex lock;
+	symbol** slots;
+	size_t count;
+	size_t capacity;
+} symbolshard;
+
+typedef struct {
+	symbolshard shards[SYMBOL_SHARDS];
+	bool failed;
+} symboltable;
+
+static uint64_t symbolhash(symbolkind kind, const char* name, size_t length) {
+	uint64_t hash = (FNV_OFFSET ^ kind) * FNV_PRIME;
+	size_t i;
+	for (i = 0; i < length; i++) {
+		hash = (hash ^ (unsigned char)tolower((unsigned char)name[i])) * FNV_PRIME;
+	}
+	return hash;
+}
+
+static bool symbolmatches(const symbol* sym, uint64_t hash, symbolkind kind, const char* name, size_t length) {
+	size_t i;
+	if (sym->hash != hash || sym->kind != kind || strlen(sym->name) != length) {
+		return false;
+	}
+	for (i = 0; i < length; i++) {
+		if (tolower((unsigned char)sym->name[i]) != tolower((unsigned char)name[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void symbolinit(symboltable* table) {
+	int i;
+	memset(table, 0, sizeof(*table));
+	for (i = 0; i < SYMBOL_SHARDS; i++) {
+		mutexinit(&table->shards[i].lock);
+	}
+}
+
+static void symbolfree(symboltable* table) {
+	int i;
+	size_t j;
+	for (i = 0; i < SYMBOL_SHARDS; i++) {
+		symbolshard* shard = &table->shards[i];
+		for (j = 0; j < shard->capacity; j++) {
+			if (shard->slots[j] != NULL) {
+				free(shard->slots[j]->name);
+				free(shard->slots[j]);
+			}
+		}
+		free(shard->slots);
+		mutexdestroy(&shard->lock);
+	}
+}
+
+/*
+ * open addressing within a shard; the low bits of the hash pick the shard,
+ * the rest pick the slot
+ */
+static bool shardgrow(symbolshard* shard) {
+	size_t capacity = shard->capacity ? shard->capacity * 2 : 64;
+	symbol** slots = calloc(capacity, sizeof(symbol*));
+	size_t i;
+	if (slots == NULL) {
+		return false;
+	}
+	for (i = 0; i < shard->capacity; i++) {
+		if (shard->slots[i] != NULL) {
+			size_t slot = (size_t)(shard->slots[i]->hash / SYMBOL_SHARDS) & (capacity - 1);
+			while (slots[slot] != NULL) {
+				slot = (slot + 1) & (capacity - 1);
+			}
+			slots[slot] = shard->slots[i];
 		}
-		if (currentstate == SUBKEY) {
-			printf("error in %s: trailing key string", argv[optind]);
+	}
+	free(shard->slots);
+	shard->slots = slots;
+	shard->capacity = capacity;
+	return true;
+}
+
+static void symbolrecord(symboltable* table, symbolkind kind, const char* name, size_t length, bool definition, int file, int line) {
+	uint64_t hash = symbolhash(kind, name, length);
+	symbolshard* shard = &table->shards[hash % SYMBOL_SHARDS];
+	symbol* sym;
+	size_t slot;
+
+	mutexlock(&shard->lock);
+	if ((shard->count + 1) * 2 > shard->capacity && !shardgrow(shard)) {
+		table->failed = true;
+		mutexunlock(&shard->lock);
+		return;
+	}
+	slot = (size_t)(hash / SYMBOL_SHARDS) & (shard->capacity - 1);
+	while ((sym = shard->slots[slot]) != NULL && !symbolmatches(sym, hash, kind, name, length)) {
+		slot = (slot + 1) & (shard->capacity - 1);
+	}
+	if (sym == NULL) {
+		sym = calloc(1, sizeof(symbol));
+		if (sym == NULL || (sym->name = malloc(length + 1)) == NULL) {
+			free(sym);
+			table->failed = true;
+			mutexunlock(&shard->lock);
+			return;
+		}
+		memcpy(sym->name, name, length);
+		sym->name[length] = '\0';
+		sym->hash = hash;
+		sym->kind = kind;
+		shard->slots[slot] = sym;
+		shard->count++;
+	}
+	if (definition) {
+		if (sym->definitions++ == 0 || file < sym->deffile || (file == sym->deffile && line < sym->defline)) {
+			sym->deffile = file;
+			sym->defline = line;
+		}
+	} else {
+		if (sym->references++ == 0 || file < sym->reffile || (file == sym->reffile && line < sym->refline)) {
+			sym->reffile = file;
+			sym->refline = line;
+		}
+	}
+	mutexunlock(&shard->lock);
+}
+
+/*
+ * keys that refer to a scheme entry by name, e.g. fgcolor_override, font or
+ * defaultBorder. key must already be lowercase.
+ */
+static symbolkind referencekind(const char* key) {
+	if (strstr(key, "color") != NULL) {
+		return SYMBOLCOLOR;
+	}
+	if (strstr(key, "font") != NULL) {
+		return SYMBOLFONT;
+	}
+	if (strstr(key, "border") != NULL) {
+		return SYMBOLBORDER;
+	}
+	return SYMBOLNONE;
+}
+
+/*
+ * literal colors and flags like "255 255 255 255" or "0" are not names
+ */
+static bool isname(const kvevent* event) {
+	return event->length > 0 && !isdigit((unsigned char)event->text[0]) && event->text[0] != '-' &&
+		event->text[0] != '.' && event->text[0] != ' ';
+}
+
+#define READ_CHUNK_SIZE 65536
+
+/*
+ * a file linted as part of a project
+ */
+typedef struct {
+	symboltable* symbols;
+	int fileid;
+	textbuffer output;
+} projectfile;
+
+typedef struct {
+	const char* filename;
+	options* opts;
+	const char* basedir;
+	kvindex* index;
+	projectfile* project;
+	kvbuilder* tree;
+	int errorcount;
+	bool checkfile;
+
+	//run of identical errors on the same or consecutive lines, printed once it ends
+	const char* pending;
+	size_t pendinglength;
+	int pendingline;
+	int pendinglast;
+	int pendingcount;
+	int messagecount;
+	bool toomany;
+
+	//lowercased last key and the first two enclosing subkeys, for symbols
+	char key[SYMBOL_KEY_LENGTH];
+	char sections[2][SYMBOL_KEY_LENGTH];
+	int depth;
+} lintcontext;
+
+static unsigned parserflags(const options* opts) {
+	unsigned flags = 0;
+	if (opts->requirequotes) {
+		flags |= KVREQUIREQUOTES;
+	}
+	if (opts->allowmultiline) {
+		flags |= KVALLOWMULTILINE;
+	}
+	if (opts->parseescapes) {
+		flags |= KVPARSEESCAPES;
+	}
+	if (opts->ignoreshrug) {
+		flags |= KVIGNORESHRUG;
+	}
+	if (opts->checkrootescapes) {
+		flags |= KVCHECKROOTESCAPES;
+	}
+	if (opts->blockcomments) {
+		flags |= KVBLOCKCOMMENTS;
+	}
+	if (opts->multipleroot) {
+		flags |= KVMULTIPLEROOT;
+	}
+	return flags;
+}
+
+static void lintflush(lintcontext* lint);
+
+static void lintprint(lintcontext* lint, const char* format, ...) {
+	va_list args;
+	if (lint->pendingcount > 0) {
+		lintflush(lint);
+	}
+	va_start(args, format);
+	if (lint->project != NULL) {
+		textappendv(&lint->project->output, format, args);
+	} else {
+		vprintf(format, args);
+	}
+	va_end(args);
+}
+
+static void lintflush(lintcontext* lint) {
+	int count = lint->pendingcount;
+	if (count == 0) {
+		return;
+	}
+	lint->pendingcount = 0;
+	if (lint->pendingline == 0) {
+		lintprint(lint, "error in %s: %.*s\n", lint->filename, (int)lint->pendinglength, lint->pending);
+	} else if (count == 1) {
+		lintprint(lint, "error in %s (line %d): %.*s\n", lint->filename, lint->pendingline, (int)lint->pendinglength, lint->pending);
+	} else if (lint->pendingline == lint->pendinglast) {
+		lintprint(lint, "error in %s (line %d): %.*s (%d times)\n", lint->filename, lint->pendingline, (int)lint->pendinglength, lint->pending, count);
+	} else {
+		lintprint(lint, "error in %s (lines %d-%d): %.*s (%d times)\n", lint->filename, lint->pendingline, lint->pendinglast, (int)lint->pendinglength, lint->pending, count);
+	}
+}
+
+/*
+ * error messages are string literals, so a pending one stays valid until
+ * it is printed
+ */
+static void linterror(lintcontext* lint, int line, const char* error, size_t length) {
+	lint->errorcount++;
+	if (lint->pendingcount > 0 && line > 0 && (line == lint->pendinglast || line == lint->pendinglast + 1) &&
+		length == lint->pendinglength && memcmp(error, lint->pending, length) == 0) {
+		lint->pendinglast = line;
+		lint->pendingcount++;
+		return;
+	}
+	lintflush(lint);
+	if (lint->opts->maxerrors > 0 && lint->messagecount == lint->opts->maxerrors) {
+		lint->toomany = true;
+		return;
+	}
+	lint->messagecount++;
+	lint->pending = error;
+	lint->pendinglength = length;
+	lint->pendingline = line;
+	lint->pendinglast = line;
+	lint->pendingcount = 1;
+}
+
+#define SNIFF_LENGTH 8192
+
+/*
+ * text files have no nul bytes and few control characters. anything else
+ * would produce an error for nearly every byte, so it is rejected up front.
+ */
+static bool checktext(lintcontext* lint, const char* data, size_t length) {
+	const char* error = NULL;
+	size_t control = 0;
+	size_t i;
+	if (length > SNIFF_LENGTH) {
+		length = SNIFF_LENGTH;
+	}
+	if (length >= 2 && ((data[0] == '\xff' && data[1] == '\xfe') || (data[0] == '\xfe' && data[1] == '\xff'))) {
+		error = "file is UTF-16 encoded, which is not supported";
+	} else {
+		for (i = 0; i < length; i++) {
+			unsigned char c = (unsigned char)data[i];
+			if (c == '\0') {
+				control = length;
+				break;
+			}
+			if ((c < 0x20 && !isspace(c)) || c == 0x7f) {
+				control++;
+			}
+		}
+		if (control * 10 > length) {
+			error = "file appears to be binary, not checking it (use -k for binary KeyValues)";
+		}
+	}
+	if (error != NULL) {
+		linterror(lint, 0, error, strlen(error));
+		return false;
+	}
+	return true;
+}
+
+static void lowercopy(char* destination, const char* source, size_t length) {
+	size_t i;
+	if (length > SYMBOL_KEY_LENGTH - 1) {
+		length = SYMBOL_KEY_LENGTH - 1;
+	}
+	for (i = 0; i < length; i++) {
+		destination[i] = (char)tolower((unsigned char)source[i]);
+	}
+	destination[length] = '\0';
+}
+
+/*
+ * BaseSettings keys are a control and a setting such as Border.Bright or
+ * FrameTitleBar.Font. the setting says whether the value is a font or a
+ * border, and anything else is a color.
+ */
+static symbolkind settingkind(const char* key) {
+	const char* dot = strrchr(key, '.');
+	symbolkind kind = referencekind(dot != NULL ? dot + 1 : key);
+	return kind == SYMBOLNONE ? SYMBOLCOLOR : kind;
+}
+
+/*
+ * definitions are the entries of Colors, Fonts and Borders in a file whose
+ * root key is Scheme. BaseSettings entries that hold colors are colors
+ * too, which color lookups fall back to. elsewhere, and for the values of
+ * BaseSettings, the key name says what kind of entry a value refers to.
+ */
+static void symbolevent(lintcontext* lint, const kvevent* event) {
+	bool scheme = lint->depth >= 1 && strcmp(lint->sections[0], "scheme") == 0;
+	symbolkind kind = SYMBOLNONE;
+	switch (event->type) {
+		case KVKEY:
+		case KVDIRECTIVE:
+			lowercopy(lint->key, event->text, event->length);
+			if (scheme && lint->depth == 2) {
+				if (strcmp(lint->sections[1], "colors") == 0) {
+					kind = SYMBOLCOLOR;
+				} else if (strcmp(lint->sections[1], "fonts") == 0) {
+					kind = SYMBOLFONT;
+				} else if (strcmp(lint->sections[1], "borders") == 0) {
+					kind = SYMBOLBORDER;
+				} else if (strcmp(lint->sections[1], "basesettings") == 0 && settingkind(lint->key) == SYMBOLCOLOR) {
+					//controls read these directly, so they are never unused
+					kind = SYMBOLCOLOR;
+					symbolrecord(lint->project->symbols, kind, event->text, event->length, false, lint->project->fileid, event->line);
+				}
+				if (kind != SYMBOLNONE) {
+					symbolrecord(lint->project->symbols, kind, event->text, event->length, true, lint->project->fileid, event->line);
+				}
+			}
+			break;
+		case KVVALUE:
+			if (!scheme) {
+				kind = referencekind(lint->key);
+			} else if (lint->depth >= 2 && strcmp(lint->sections[1], "basesettings") == 0) {
+				kind = settingkind(lint->key);
+			} else if (lint->depth >= 2 && strcmp(lint->sections[1], "borders") == 0) {
+				kind = referencekind(lint->key);
+			}
+			if (kind != SYMBOLNONE && isname(event)) {
+				symbolrecord(lint->project->symbols, kind, event->text, event->length, false, lint->project->fileid, event->line);
+			}
+			break;
+		case KVOPEN:
+			if (lint->depth < 2) {
+				strcpy(lint->sections[lint->depth], lint->key);
+			}
+			lint->depth++;
+			lint->key[0] = '\0';
+			break;
+		case KVCLOSE:
+			lint->depth--;
+			break;
+		default:
+			break;
+	}
+}
+
+static void checkinclude(lintcontext* lint, const kvevent* event) {
+#ifdef _WIN32
+	if (event->length > MAX_PATH - strlen(lint->basedir) - 1) { //Windows adds a slash, POSIX does not
+#else
+	if (event->length > MAX_PATH - strlen(lint->basedir) - 2) {
+#endif
+		linterror(lint, event->line, "included file path too long", strlen("included file path too long"));
+	} else {
+		char path[MAX_PATH];
+		strcpy(path, lint->basedir);
+#ifndef _WIN32
+		strcat(path, "/");
+#endif
+		strncat(path, event->text, event->length);
+		if (!isfile(path)) {
+			linterror(lint, event->line, "unreadable included file", strlen("unreadable included file"));
+		}
+	}
+}
+
+/*
+ * the lint checks themselves live in the parser; this reports them, checks
+ * #base directives and feeds the index
+ */
+static int lintevent(const kvevent* event, void* context) {
+	lintcontext* lint = context;
+	if (lint->project != NULL) {
+		symbolevent(lint, event);
+	}
+	if (lint->tree != NULL) {
+		kvbuildevent(lint->tree, event);
+	}
+	switch (event->type) {
+		case KVERROR:
+			linterror(lint, event->line, event->text, event->length);
+			break;
+		case KVDIRECTIVE:
+			lint->checkfile = lint->basedir != NULL && event->length == 5 && memcmp(event->text, "#base", 5) == 0;
+			if (lint->index != NULL) {
+				indexkey(lint->index, event->text, event->length);
+			}
+			break;
+		case KVKEY:
+			lint->checkfile = false;
+			if (lint->index != NULL) {
+				indexkey(lint->index, event->text, event->length);
+			}
+			break;
+		case KVVALUE:
+			if (lint->checkfile) {
+				lint->checkfile = false;
+				checkinclude(lint, event);
+			}
+			if (lint->index != NULL) {
+				indexvalue(lint->index, event->offset, event->length);
+			}
+			break;
+		case KVOPEN:
+			lint->checkfile = false;
+			if (lint->index != NULL) {
+				indexopen(lint->index, event->offset);
+			}
+			break;
+		case KVCLOSE:
+			if (lint->index != NULL) {
+				indexclose(lint->index, event->offset + 1);
+			}
+			break;
+		default:
+			break;
+	}
+	//stop parsing once -n has been reached
+	return lint->toomany ? 1 : 0;
+}
+
+static bool feedchunk(const char* data, size_t length, void* context) {
+	kvparser* parser = context;
+	if (parser->offset == 0 && !checktext(parser->context, data, length)) {
+		return false;
+	}
+	return kvfeed(parser, data, length) == KVOK;
+}
+
+/*
+ * feed a file that cannot be mapped through a buffer instead
+ */
+static int feedstream(lintcontext* lint, kvparser* parser, uint64_t* hash) {
+	char buffer[READ_CHUNK_SIZE];
+	size_t length;
+	//offsets have to match the bytes on disk, so no newline translation
+	FILE* kvfile = fopen(lint->filename, "rb");
+	if (kvfile == NULL) {
+		lintprint(lint, "error: unable to open file %s\n", lint->filename);
+		return -1;
+	}
+	if (parser->offset > 0 && fseek64(kvfile, parser->offset, SEEK_SET) != 0) {
+		lintprint(lint, "error: unable to seek in file %s\n", lint->filename);
+		fclose(kvfile);
+		return -1;
+	}
+	while ((length = fread(buffer, 1, sizeof(buffer), kvfile)) > 0) {
+		if (parser->offset == 0 && kvdetect(buffer, length) != COMPRESSIONNONE) {
+			lintprint(lint, "error: %s is compressed and can only be read from a regular file\n", lint->filename);
+			fclose(kvfile);
+			return -1;
+		}
+		if (parser->offset == 0 && !checktext(lint, buffer, length)) {
+			fclose(kvfile);
+			return -1;
+		}
+		*hash = fnv(*hash, buffer, length);
+		if (kvfeed(parser, buffer, length) != KVOK) {
+			break;
+		}
+	}
+	fclose(kvfile);
+	return 0;
+}
+
+static int lintfile(const char* filename, options* opts, kvindex* index, projectfile* project, kvbuilder* tree) {
+	int rcode = 0;
+	lintcontext lint = {0};
+	kvparser parser;
+	mappedfile mf;
+	uint64_t hash = FNV_OFFSET;
+	char* abspath;
+	char* basedir;
+	struct stat st;
+	kvcompression compression = COMPRESSIONNONE;
+
+	lint.filename = filename;
+	lint.opts = opts;
+	lint.index = index;
+	lint.project = project;
+	lint.tree = tree;
+	kvinit(&parser, parserflags(opts), lintevent, &lint);
+
+	if (index != NULL) {
+		if (stat(filename, &st) == -1) {
+			lintprint(&lint, "error: unable to open file %s\n", filename);
+			return rcode;
+		}
+		switch (indexprepare(filename, &st, opts, index)) {
+			case INDEXCURRENT:
+				return rcode;
+			case INDEXAPPEND:
+				kvresume(&parser, index->start, index->linecount, index->endstate);
+				hash = index->hash;
+				break;
+			case INDEXFULL:
+				break;
+		}
+	}
+
+	if (opts->validatedirectives) {
+#ifdef _WIN32
+		abspath = _fullpath(NULL, filename, MAX_PATH);
+		if (abspath == NULL) {
+			lintprint(&lint, "unable to resolve full path, not validating directives\n");
+			opts->validatedirectives = false;
+			rcode = 1;
+		} else {
+			basedir = malloc(_MAX_DRIVE + _MAX_DIR * sizeof(char));
+			if (basedir == NULL) {
+				lintprint(&lint, "unable to allocate memory for base directory, not validating directives\n");
+				free(abspath);
+				opts->validatedirectives = false;
+				rcode = 1;
+			} else {
+				basedir[0] = '\0';
+				char drive[_MAX_DRIVE];
+				char path[_MAX_DIR];
+				_splitpath_s(abspath, drive, _MAX_DRIVE, path, _MAX_DIR, NULL, 0, NULL, 0);
+				strcat_s(basedir, _MAX_DRIVE + _MAX_DIR, drive);
+				strcat_s(basedir, _MAX_DRIVE + _MAX_DIR, path);
+				lint.basedir = basedir;
+			}
+		}
+#else
+		abspath = realpath(filename, NULL);
+		if (abspath == NULL) {
+			lintprint(&lint, "unable to resolve full path, not validating directives\n");
+			opts->validatedirectives = false;
+			rcode = 1;
+		} else {
+			basedir = dirname(abspath);
+			if (basedir == NULL) {
+				lintprint(&lint, "unable to determine base directory, not validating directives\n");
+				free(abspath);
+				opts->validatedirectives = false;
+				rcode = 1;
+			} else {
+				lint.basedir = basedir;
+			}
+		}
+#endif
+	}
+
+	if (mapfile(filename, &mf) && parser.offset <= mf.size) {
+		const char* data = mf.data + parser.offset;
+		size_t length = (size_t)(mf.size - parser.offset);
+		compression = kvdetect(data, length);
+		if (compression != COMPRESSIONNONE) {
+			//offsets into the decompressed data cannot be looked up in the file
+			const char* error;
+			lint.index = NULL;
+			error = kvdecompress(compression, data, length, feedchunk, &parser);
+			if (error != NULL) {
+				linterror(&lint, 0, error, strlen(error));
+			}
+		} else if (parser.offset > 0 || checktext(&lint, data, length)) {
+			if (index != NULL) {
+				hash = fnv(hash, data, length);
+			}
+			kvfeed(&parser, data, length);
+		}
+		kvfinish(&parser);
+		unmapfile(&mf);
+	} else if (feedstream(&lint, &parser, &hash) == 0) {
+		kvfinish(&parser);
+	} else {
+		lint.errorcount++;
+	}
+	kvfree(&parser);
+	if (parser.failed || parser.internalerror) {
+		rcode = 1;
+	}
+	lintflush(&lint);
+	if (lint.toomany) {
+		lintprint(&lint, "error in %s: too many errors, stopping\n", filename);
+	}
+
+	if (lint.basedir != NULL) {
+		free(abspath);
+#ifdef _WIN32
+		free(basedir);
+#endif
+	}
+	if (index != NULL) {
+		//offsets into a file with errors are meaningless, so only index clean files
+		if (compression != COMPRESSIONNONE) {
+			lintprint(&lint, "unable to index %s compressed file %s\n", kvcompressionname(compression), filename);
+			rcode = 1;
+		} else if (lint.errorcount == 0 && rcode == 0) {
+			if (index->failed) {
+				lintprint(&lint, "unable to allocate memory for index of %s\n", filename);
+				rcode = 1;
+			} else {
+				index->start = parser.offset;
+				index->linecount = parser.linecount;
+				index->endstate = parser.currentstate;
+				index->hash = hash;
+				if (!indexwrite(filename, &st, opts, index)) {
+					lintprint(&lint, "unable to write index for %s\n", filename);
+					rcode = 1;
+				}
+			}
+		}
+		indexfree(index);
+	}
+
+	return rcode;
+}
+
+/*
+ * bring the index of a file up to date and print the value at a key path
+ */
+static int queryfile(const char* filename, options* opts, const char* keypath, bool showname) {
+	int rcode;
+	kvindex index = {0};
+	mappedfile indexmap;
+	mappedfile filemap;
+	const indexheader* header;
+	const indexentry* entry;
+	struct stat st;
+	char* name;
+
+	rcode = lintfile(filename, opts, &index, NULL, NULL);
+	if (rcode != 0) {
+		return rcode;
+	}
+	name = indexfilename(filename);
+	if (name == NULL || !mapfile(name, &indexmap)) {
+		free(name);
+		printf("error: no usable index for %s\n", filename);
+		return 1;
+	}
+	free(name);
+	header = indexcheck(&indexmap);
+	//another process may have changed the file since it was linted
+	if (header == NULL || header->options != optionbits(opts) || stat(filename, &st) == -1 || !indexcurrent(header, filename, &st)) {
+		unmapfile(&indexmap);
+		printf("error: no usable index for %s\n", filename);
+		return 1;
+	}
+	entry = indexlookup(header, keypath);
+	if (entry == NULL) {
+		printf("error in %s: no key %s\n", filename, keypath);
+		rcode = 1;
+	} else if (!mapfile(filename, &filemap)) {
+		printf("error: unable to open file %s\n", filename);
+		rcode = 1;
+	} else {
+		if (entry->valueoffset + entry->valuelength > filemap.size) {
+			printf("error: index for %s is corrupt\n", filename);
+			rcode = 1;
+		} else {
+			if (showname) {
+				printf("%s: ", filename);
+			}
+			fwrite(filemap.data + entry->valueoffset, 1, (size_t)entry->valuelength, stdout);
+			printf("\n");
+		}
+		unmapfile(&filemap);
+	}
+	unmapfile(&indexmap);
+	return rcode;
+}
+
+/*
+ * binary files are checked straight from the mapping, so unlike text files
+ * they cannot come from a pipe
+ */
+static int binaryfile(const char* filename) {
+	mappedfile mf;
+	kvbinaryresult result;
+	if (!mapfile(filename, &mf)) {
+		printf("error: unable to map file %s\n", filename);
+		return 1;
+	}
+	if (mf.size > SIZE_MAX) {
+		printf("error: %s is too large to check\n", filename);
+		unmapfile(&mf);
+		return 1;
+	}
+	if (kvdetect(mf.data, (size_t)mf.size) != COMPRESSIONNONE) {
+		printf("error: %s is compressed, binary files have to be decompressed first\n", filename);
+		unmapfile(&mf);
+		return 1;
+	}
+	kvbinarycheck(mf.data, (size_t)mf.size, &result);
+	if (result.error != NULL) {
+		printf("error in %s (offset %llu): %s\n", filename, (unsigned long long)result.offset, result.error);
+	}
+	unmapfile(&mf);
+	//a corrupt cache should fail a build, not just print a message
+	return result.error != NULL;
+}
+
+/*
+ * project mode: lint a whole HUD in parallel and cross-check the scheme
+ * entries it defines and references
+ */
+typedef struct {
+	char** names;
+	size_t count;
+	size_t capacity;
+} filelist;
+
+typedef struct {
+	filelist* files;
+	projectfile* results;
+	int* rcodes;
+	const options* opts;
+	volatile long next;
+} projectjob;
+
+static bool endswith(const char* name, const char* suffix) {
+	size_t length = strlen(name);
+	size_t suffixlength = strlen(suffix);
+	size_t i;
+	if (length < suffixlength) {
+		return false;
+	}
+	for (i = 0; i < suffixlength; i++) {
+		if (tolower((unsigned char)name[length - suffixlength + i]) != suffix[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool addfile(filelist* list, const char* name) {
+	char* copy = malloc(strlen(name) + 1);
+	if (copy == NULL || !reserve((void**)&list->names, &list->capacity, list->count + 1, sizeof(char*))) {
+		free(copy);
+		return false;
+	}
+	strcpy(copy, name);
+	list->names[list->count++] = copy;
+	return true;
+}
+
+/*
+ * add a file, or every .res file below a directory
+ */
+static bool collectfiles(filelist* list, const char* path) {
+	struct stat st;
+	bool ok = true;
+	if (stat(path, &st) == -1 || (st.st_mode & S_IFMT) != S_IFDIR) {
+		//missing files are reported when they are linted
+		return addfile(list, path);
+	}
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE search;
+	char pattern[MAX_PATH];
+	if (strlen(path) + 3 > MAX_PATH) {
+		return false;
+	}
+	strcpy(pattern, path);
+	strcat(pattern, "\\*");
+	search = FindFirstFileA(pattern, &entry);
+	if (search == INVALID_HANDLE_VALUE) {
+		return true;
+	}
+	do {
+		const char* name = entry.cFileName;
+#else
+	struct dirent* entry;
+	DIR* directory = opendir(path);
+	if (directory == NULL) {
+		return true;
+	}
+	while (ok && (entry = readdir(directory)) != NULL) {
+		const char* name = entry->d_name;
+#endif
+		char* child;
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+			continue;
+		}
+		child = malloc(strlen(path) + strlen(name) + 2);
+		if (child == NULL) {
+			ok = false;
+			break;
+		}
+		strcpy(child, path);
+		strcat(child, "/");
+		strcat(child, name);
+		if (stat(child, &st) != -1 && (st.st_mode & S_IFMT) == S_IFDIR) {
+			ok = collectfiles(list, child);
+		} else if (endswith(name, ".res")) {
+			ok = addfile(list, child);
+		}
+		free(child);
+#ifdef _WIN32
+	} while (ok && FindNextFileA(search, &entry));
+	FindClose(search);
+#else
+	}
+	closedir(directory);
+#endif
+	return ok;
+}
+
+static int comparenames(const void* a, const void* b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static kvthreadresult KVTHREADCALL projectworker(void* argument) {
+	projectjob* job = argument;
+	long i;
+	while ((i = atomicincrement(&job->next)) < (long)job->files->count) {
+		//lintfile may turn options off when they fail for a file
+		options opts = *job->opts;
+		job->rcodes[i] = lintfile(job->files->names[i], &opts, NULL, &job->results[i], NULL);
+	}
+	return 0;
+}
+
+static int comparesymbols(const void* a, const void* b) {
+	const symbol* sa = *(symbol* const*)a;
+	const symbol* sb = *(symbol* const*)b;
+	int fa = sa->definitions ? sa->deffile : sa->reffile;
+	int fb = sb->definitions ? sb->deffile : sb->reffile;
+	int la = sa->definitions ? sa->defline : sa->refline;
+	int lb = sb->definitions ? sb->defline : sb->refline;
+	if (fa != fb) {
+		return fa < fb ? -1 : 1;
+	}
+	if (la != lb) {
+		return la < lb ? -1 : 1;
+	}
+	return strcmp(sa->name, sb->name);
+}
+
+/*
+ * report references to undefined entries and definitions nothing uses
+ */
+static int reportsymbols(symboltable* table, filelist* files) {
+	symbol** symbols = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	size_t definitions = 0;
+	size_t i;
+	int j;
+
+	for (j = 0; j < SYMBOL_SHARDS; j++) {
+		for (i = 0; i < table->shards[j].capacity; i++) {
+			symbol* sym = table->shards[j].slots[i];
+			if (sym == NULL) {
+				continue;
+			}
+			definitions += sym->definitions > 0;
+			if ((sym->definitions == 0) != (sym->references == 0)) {
+				if (!reserve((void**)&symbols, &capacity, count + 1, sizeof(symbol*))) {
+					free(symbols);
+					printf("unable to allocate memory for symbol report\n");
+					return 1;
+				}
+				symbols[count++] = sym;
+			}
+		}
+	}
+	if (definitions == 0) {
+		//without a scheme every reference would be reported
+		printf("no scheme definitions found, not checking references\n");
+		free(symbols);
+		return 0;
+	}
+	qsort(symbols, count, sizeof(symbol*), comparesymbols);
+	for (i = 0; i < count; i++) {
+		symbol* sym = symbols[i];
+		if (sym->definitions == 0) {
+			printf("error in %s (line %d): undefined %s \"%s\"", files->names[sym->reffile], sym->refline, symbolkinds[sym->kind], sym->name);
+			if (sym->references > 1) {
+				printf(" (%d references)", sym->references);
+			}
+			printf("\n");
+		} else {
+			printf("warning in %s (line %d): unused %s \"%s\"\n", files->names[sym->deffile], sym->defline, symbolkinds[sym->kind], sym->name);
+		}
+	}
+	free(symbols);
+	return 0;
+}
+
+static int lintproject(char** paths, int count, const options* opts, int threadcount) {
+	int rcode = 0;
+	filelist files = {0};
+	symboltable table;
+	projectjob job;
+	kvthread* threads;
+	int started = 0;
+	size_t i;
+	int j;
+
+	for (j = 0; j < count; j++) {
+		if (!collectfiles(&files, paths[j])) {
+			printf("unable to list files in %s\n", paths[j]);
+			rcode = 1;
+		}
+	}
+	qsort(files.names, files.count, sizeof(char*), comparenames);
+
+	symbolinit(&table);
+	job.files = &files;
+	job.opts = opts;
+	job.next = 0;
+	job.results = calloc(files.count + 1, sizeof(projectfile));
+	job.rcodes = calloc(files.count + 1, sizeof(int));
+	threads = calloc(threadcount, sizeof(kvthread));
+	if (job.results == NULL || job.rcodes == NULL || threads == NULL) {
+		printf("unable to allocate memory for project\n");
+		rcode = 1;
+	} else {
+		for (i = 0; i < files.count; i++) {
+			job.results[i].symbols = &table;
+			job.results[i].fileid = (int)i;
+		}
+		for (j = 0; j < threadcount; j++) {
+			if (threadstart(&threads[started], projectworker, &job)) {
+				started++;
+			}
+		}
+		if (started == 0) {
+			//no threads available, do the work here
+			projectworker(&job);
+		}
+		for (j = 0; j < started; j++) {
+			threadjoin(threads[j]);
+		}
+		for (i = 0; i < files.count; i++) {
+			if (job.results[i].output.length > 0) {
+				fwrite(job.results[i].output.data, 1, job.results[i].output.length, stdout);
+			}
+			free(job.results[i].output.data);
+			rcode |= job.rcodes[i];
+		}
+		if (table.failed) {
+			printf("unable to allocate memory for symbol table\n");
+			rcode = 1;
+		} else {
+			rcode |= reportsymbols(&table, &files);
+		}
+	}
+
+	free(threads);
+	free(job.results);
+	free(job.rcodes);
+	symbolfree(&table);
+	for (i = 0; i < files.count; i++) {
+		free(files.names[i]);
+	}
+	free(files.names);
+	return rcode;
+}
+
+/*
+ * -a reads every file once. the merged tree of a #base file is built the
+ * first time something includes it and shared by everything after that.
+ */
+typedef struct {
+	char* name; //as given or as resolved from the includer, for messages
+	char* path; //full path, to recognize a file reached in different ways
+	const kvnode** roots;
+	size_t rootcount;
+	const kvnode* merged; //first root key with the #base chain applied
+	bool reading;         //including it now would be a cycle
+} treefile;
+
+typedef struct {
+	options* opts;
+	kvarena arena;
+	kvmerger merger;
+	treefile* files;
+	size_t count;
+	size_t capacity;
+	int current; //file whose #base files are being merged
+	bool failed;
+	int rcode;
+} treecache;
+
+static void reportconflict(const kvnode* node, const kvnode* base, void* context) {
+	treecache* cache = context;
+	printf("error in %s: \"%s\" is a %s in %s (line %d) but a %s in %s (line %d)\n", cache->files[cache->current].name, node->name,
+		node->value != NULL ? "value" : "subkey", cache->files[node->file].name, node->line,
+		base->value != NULL ? "value" : "subkey", cache->files[base->file].name, base->line);
+}
+
+static char* fullpath(const char* filename) {
+#ifdef _WIN32
+	return _fullpath(NULL, filename, MAX_PATH);
+#else
+	return realpath(filename, NULL);
+#endif
+}
+
+/*
+ * #base paths are relative to the directory of the including file
+ */
+static char* basepath(const char* filename, const char* include) {
+	const char* slash = strrchr(filename, '/');
+	size_t prefix;
+	char* path;
+#ifdef _WIN32
+	const char* backslash = strrchr(filename, '\\');
+	if (backslash != NULL && (slash == NULL || backslash > slash)) {
+		slash = backslash;
+	}
+#endif
+	prefix = slash != NULL ? (size_t)(slash - filename) + 1 : 0;
+	path = malloc(prefix + strlen(include) + 1);
+	if (path != NULL) {
+		memcpy(path, filename, prefix);
+		strcpy(path + prefix, include);
+	}
+	return path;
+}
+
+/*
+ * returns the id of the file, or -1 when it cannot be read
+ */
+static int loadtree(treecache* cache, const char* name) {
+	kvbuilder builder;
+	char* path;
+	int id;
+	size_t i;
+
+	path = fullpath(name);
+	if (path == NULL) {
+		printf("error: unable to open file %s\n", name);
+		return -1;
+	}
+	for (i = 0; i < cache->count; i++) {
+		if (strcmp(cache->files[i].path, path) == 0) {
+			free(path);
+			return (int)i;
+		}
+	}
+	if (!reserve((void**)&cache->files, &cache->capacity, cache->count + 1, sizeof(treefile)) ||
+		(cache->files[cache->count].name = malloc(strlen(name) + 1)) == NULL) {
+		free(path);
+		cache->failed = true;
+		return -1;
+	}
+	id = (int)cache->count++;
+	strcpy(cache->files[id].name, name);
+	cache->files[id].path = path;
+
+	kvbuildinit(&builder, &cache->arena, id);
+	cache->rcode |= lintfile(name, cache->opts, NULL, NULL, &builder);
+	kvbuildfinish(&builder);
+	if (builder.failed) {
+		kvbuildfree(&builder);
+		cache->failed = true;
+		return -1;
+	}
+	cache->files[id].roots = builder.roots;
+	cache->files[id].rootcount = builder.rootcount;
+	cache->files[id].merged = builder.rootcount > 0 ? builder.roots[0] : NULL;
+	cache->files[id].reading = true;
+
+	//earlier #base files take precedence over later ones
+	for (i = 0; i < builder.basecount && !cache->failed; i++) {
+		const kvnode* merged;
+		char* include = basepath(name, builder.bases[i].path);
+		int base;
+		if (include == NULL) {
+			cache->failed = true;
+			break;
+		}
+		if (!isfile(include)) {
+			//-d has already reported it
+			if (!cache->opts->validatedirectives) {
+				printf("error in %s (line %d): unreadable included file\n", name, builder.bases[i].line);
+			}
+			free(include);
+			continue;
+		}
+		base = loadtree(cache, include);
+		free(include);
+		if (base < 0) {
+			continue;
+		}
+		if (cache->files[base].reading) {
+			printf("error in %s (line %d): #base cycle through %s\n", name, builder.bases[i].line, cache->files[base].name);
+			continue;
+		}
+		if (cache->files[base].merged == NULL) {
+			continue;
+		}
+		cache->current = id;
+		merged = kvmerge(&cache->merger, cache->files[id].merged, cache->files[base].merged);
+		if (merged == NULL) {
+			cache->failed = true;
+			break;
+		}
+		cache->files[id].merged = merged;
+	}
+	cache->files[id].reading = false;
+	kvbuildfree(&builder);
+	return cache->failed ? -1 : id;
+}
+
+static int mergefiles(char** paths, int count, options* opts, bool dump) {
+	treecache cache = {0};
+	filelist files = {0};
+	size_t i;
+	size_t j;
+	int k;
+
+	cache.opts = opts;
+	kvmergerinit(&cache.merger, &cache.arena, reportconflict, &cache);
+	for (k = 0; k < count; k++) {
+		if (!collectfiles(&files, paths[k])) {
+			printf("unable to list files in %s\n", paths[k]);
+			cache.rcode = 1;
+		}
+	}
+	qsort(files.names, files.count, sizeof(char*), comparenames);
+
+	for (i = 0; i < files.count && !cache.failed; i++) {
+		int id = loadtree(&cache, files.names[i]);
+		if (id < 0 || !dump) {
+			continue;
+		}
+		if (files.count > 1) {
+			printf("// %s\n", files.names[i]);
+		}
+		if (cache.files[id].merged != NULL && !kvdump(&cache.merger, stdout, cache.files[id].merged, 0)) {
+			cache.failed = true;
+		}
+		for (j = 1; j < cache.files[id].rootcount && !cache.failed; j++) {
+			cache.failed = !kvdump(&cache.merger, stdout, cache.files[id].roots[j], 0);
+		}
+	}
+	if (cache.failed) {
+		printf("unable to allocate memory for merged trees\n");
+		cache.rcode = 1;
+	}
+
+	for (i = 0; i < cache.count; i++) {
+		free(cache.files[i].name);
+		free(cache.files[i].path);
+	}
+	free(cache.files);
+	kvmergerfree(&cache.merger);
+	kvarenafree(&cache.arena);
+	for (i = 0; i < files.count; i++) {
+		free(files.names[i]);
+	}
+	free(files.names);
+	return cache.rcode;
+}
+
+int main(int argc, char** argv) {
+	int rcode = 0;
+
+#ifndef _WIN32
+	extern int optind;
+#endif
+	int opt;
+	bool die = false;
+
+	options opts = {0};
+	opts.checkrootescapes = true;
+	bool buildindex = false;
+	const char* keypath = NULL;
+	bool project = false;
+	int threadcount = 0;
+	long maxerrors;
+	char* end;
+	bool binary = false;
+	bool merge = false;
+	bool dump = false;
+
+	while ((opt = getopt(argc, argv, "hqmeswbdrn:ig:pj:kao")) != -1) {
+		switch (opt) {
+			case 'q':
+				opts.requirequotes = true;
+				break;
+			case 'm':
+				opts.allowmultiline = true;
+				break;
+			case 'e':
+				opts.parseescapes = true;
+				break;
+			case 's':
+				opts.ignoreshrug = true;
+				break;
+			case 'w':
+				opts.checkrootescapes = false;
+				break;
+			case 'b':
+				opts.blockcomments = true;
+				break;
+			case 'd':
+				opts.validatedirectives = true;
+				break;
+			case 'r':
+				opts.multipleroot = true;
+				break;
+			case 'n':
+				//0 turns the limit off, so a typo must not be read as 0
+				maxerrors = strtol(optarg, &end, 10);
+				if (end == optarg || *end != '\0' || maxerrors > INT_MAX) {
+					printf("invalid error limit %s\n", optarg);
+					die = true;
+				} else if (maxerrors < 0) {
+					printf("error limit cannot be negative\n");
+					die = true;
+				} else {
+					opts.maxerrors = (int)maxerrors;
+				}
+				break;
+			case 'i':
+				buildindex = true;
+				break;
+			case 'g':
+				keypath = optarg;
+				break;
+			case 'p':
+				project = true;
+				break;
+			case 'j':
+				threadcount = atoi(optarg);
+				if (threadcount < 1) {
+					printf("thread count must be at least 1\n");
+					die = true;
+				}
+				break;
+			case 'k':
+				binary = true;
+				break;
+			case 'o':
+				dump = true;
+				//fall through
+			case 'a':
+				merge = true;
+				break;
+			case 'h':
+			case '?':
+				//getopt prints an error message
+				die = true;
+				break;
+		}
+	}
+
+	if (project && (buildindex || keypath != NULL)) {
+		printf("-p cannot be combined with -i or -g\n");
+		die = true;
+	}
+	if (binary && (project || buildindex || keypath != NULL)) {
+		printf("-k cannot be combined with -i, -g or -p\n");
+		die = true;
+	}
+	if (merge && (binary || project || buildindex || keypath != NULL)) {
+		printf("-a cannot be combined with -i, -g, -p or -k\n");
+		die = true;
+	}
+
+	if (die || optind >= argc) {
+		printf("usage: %s -h | [-q] [-m] [-e [-s] [-w]] [-b] [-d] [-r] [-n <count>] [-i | -g <path> | -p [-j <threads>] | -k | -a [-o]] <filename> [...]\n", argv[0]);
+		printf("\t-h:\tshow usage message\n");
+		printf("\t-q:\trequire all keys and values to be quoted\n");
+		printf("\t-m:\tallow raw newlines in strings\n");
+		printf("\t-e:\tparse and validate escape sequences\n");
+		printf("\t-s:\tignore shrug emote when validating escape sequences\n");
+		printf("\t-w:\tignore invalid escape sequences in the first root key string\n");
+		printf("\t-b:\tallow block comments\n");
+		printf("\t-d:\tvalidate #base directives\n");
+		printf("\t-r:\tallow multiple root keys\n");
+		printf("\t-n:\tstop checking a file after this many errors (default: no limit)\n");
+		printf("\t-i:\twrite an index of key paths to <filename>.kvi\n");
+		printf("\t-g:\tprint the value of a key path such as \"players/STEAM_0:1:123/points\" using the index\n");
+		printf("\t-p:\tlint files and directories as one HUD and check color, font and border names\n");
+		printf("\t-j:\tnumber of threads for -p (default: one per processor)\n");
+		printf("\t-k:\tcheck binary KeyValues files instead of text\n");
+		printf("\t-a:\tmerge each file with its #base files and check the result\n");
+		printf("\t-o:\tprint the merged files (implies -a)\n");
+		return 1;
+	}
+
+	if (merge) {
+		return mergefiles(argv + optind, argc - optind, &opts, dump);
+	}
+
+	if (project) {
+		return lintproject(argv + optind, argc - optind, &opts, threadcount ? threadcount : processorcount());
+	}
+
+	//name the file in query output only when there is more than one
+	bool showname = argc - optind > 1;
+	for (; optind < argc; optind++) {
+		if (binary) {
+			rcode |= binaryfile(argv[optind]);
+		} else if (keypath != NULL) {
+			rcode |= queryfile(argv[optind], &opts, keypath, showname);
+		} else if (buildindex) {
+			kvindex index = {0};
+			rcode |= lintfile(argv[optind], &opts, &index, NULL, NULL);
+		} else {
+			rcode |= lintfile(argv[optind], &opts, NULL, NULL, NULL);
 		}
 	}
 	
@@ -0,0 +1,735 @@
+/*
+ * kvparse.c - event based tokenizer for KeyValues files
+ *
+ * Copyright (c) 2015-2016 Sam Heybey
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "kvparse.h"
+
+#define BUGMESSAGE "you've found a bug in kvlint! please submit an issue on github with this error message and the file you're linting."
+
+void kvinit(kvparser* parser, unsigned flags, kvhandler handler, void* context) {
+	memset(parser, 0, sizeof(*parser));
+	parser->flags = flags;
+	parser->handler = handler;
+	parser->context = context;
+	parser->linecount = 1;
+	parser->lastbserror = -1;
+	parser->prevstate = KVSTATEKEY;
+	parser->currentstate = KVSTATEKEY;
+}
+
+void kvresume(kvparser* parser, uint64_t offset, int linecount, kvstate state) {
+	parser->offset = offset;
+	parser->linestart = offset;
+	parser->linecount = linecount;
+	parser->currentstate = state;
+}
+
+void kvfree(kvparser* parser) {
+	free(parser->scratch);
+	parser->scratch = NULL;
+	parser->scratchlength = 0;
+	parser->scratchcapacity = 0;
+}
+
+static bool scratchappend(kvparser* parser, const char* data, size_t length) {
+	if (parser->scratchlength + length > parser->scratchcapacity) {
+		size_t capacity = parser->scratchcapacity ? parser->scratchcapacity : KVMAXSTRINGLENGTH;
+		char* scratch;
+		while (capacity < parser->scratchlength + length) {
+			capacity *= 2;
+		}
+		scratch = realloc(parser->scratch, capacity);
+		if (scratch == NULL) {
+			parser->failed = true;
+			return false;
+		}
+		parser->scratch = scratch;
+		parser->scratchcapacity = capacity;
+	}
+	memcpy(parser->scratch + parser->scratchlength, data, length);
+	parser->scratchlength += length;
+	return true;
+}
+
+static void dispatch(kvparser* parser, kvevent* event) {
+	if (!parser->stopped && parser->handler(event, parser->context) != 0) {
+		parser->stopped = true;
+	}
+}
+
+static void error(kvparser* parser, const char* message) {
+	kvevent event;
+	event.type = KVERROR;
+	event.text = message;
+	event.length = strlen(message);
+	event.offset = parser->charoffset;
+	event.line = parser->linecount;
+	event.column = (int)(parser->charoffset - parser->linestart) + 1;
+	event.quoted = false;
+	dispatch(parser, &event);
+}
+
+static void fileerror(kvparser* parser, const char* message) {
+	kvevent event;
+	event.type = KVERROR;
+	event.text = message;
+	event.length = strlen(message);
+	event.offset = parser->offset;
+	event.line = 0;
+	event.column = 0;
+	event.quoted = false;
+	dispatch(parser, &event);
+}
+
+static void bug(kvparser* parser, const char* message) {
+	error(parser, BUGMESSAGE);
+	error(parser, message);
+	parser->internalerror = true;
+}
+
+static void begin(kvparser* parser, uint64_t start) {
+	parser->tokenstart = start;
+	parser->tokenline = parser->linecount;
+	parser->tokencolumn = (int)(start - parser->linestart) + 1;
+	parser->scratchlength = 0;
+}
+
+/*
+ * report the token from tokenstart up to but not including end
+ */
+static void emit(kvparser* parser, kveventtype type, uint64_t end) {
+	kvevent event;
+	event.type = type;
+	event.offset = parser->tokenstart;
+	event.length = (size_t)(end - parser->tokenstart);
+	event.line = parser->tokenline;
+	event.column = parser->tokencolumn;
+	event.quoted = parser->quoted && (type == KVKEY || type == KVVALUE || type == KVDIRECTIVE);
+	if (parser->tokenstart >= parser->chunkbase) {
+		event.text = parser->chunk + (parser->tokenstart - parser->chunkbase);
+	} else {
+		//started in an earlier chunk, scratch holds everything up to this one
+		if (end > parser->chunkbase && !scratchappend(parser, parser->chunk, (size_t)(end - parser->chunkbase))) {
+			return;
+		}
+		event.text = parser->scratch;
+	}
+	parser->scratchlength = 0;
+	dispatch(parser, &event);
+}
+
+/*
+ * report a single character token at the current position
+ */
+static void emitchar(kvparser* parser, kveventtype type) {
+	begin(parser, parser->charoffset);
+	emit(parser, type, parser->offset);
+}
+
+static bool intoken(const kvparser* parser) {
+	switch (parser->currentstate) {
+		case KVSTATEKEYSTRING:
+		case KVSTATEVALUESTRING:
+		case KVSTATESTRINGESCAPE:
+		case KVSTATESLASH:
+		case KVSTATELINECOMMENT:
+		case KVSTATEBLOCKCOMMENT:
+		case KVSTATEBLOCKASTERISK:
+		case KVSTATECONDITIONAL:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static void step(kvparser* parser, int character) {
+	bool requirequotes = parser->flags & KVREQUIREQUOTES;
+	bool allowmultiline = parser->flags & KVALLOWMULTILINE;
+	bool parseescapes = parser->flags & KVPARSEESCAPES;
+
+	switch (parser->currentstate) {
+		case KVSTATEKEY:
+			//newline, whitespace, close brace, string, or comment
+			switch (character) {
+				case '\n':
+				case '\t':
+				case ' ':
+					//no state change
+					break;
+				case '}':
+					if (--parser->bracecount < 0) {
+						if (requirequotes) {
+							error(parser, "unexpected close brace");
+						} else {
+							error(parser, "unexpected close brace (you cannot use braces in unquoted strings)");
+						}
+						parser->bracecount = 0;
+					} else {
+						emitchar(parser, KVCLOSE);
+					}
+					if (parser->bracecount == 0 && !(parser->flags & KVMULTIPLEROOT)) {
+						parser->currentstate = KVSTATEENDOFROOT;
+					}
+					break;
+				case '{':
+					error(parser, "unexpected open brace (maybe you forgot to name a key)");
+					parser->bracecount++;
+					emitchar(parser, KVOPEN);
+					break;
+				case '\'':
+					error(parser, "unexpected single quote (use double quotes instead)");
+					break;
+				case '"':
+					parser->quoted = true;
+					parser->overflow = false;
+					parser->directive = false;
+					parser->currentstate = KVSTATEKEYSTRING;
+					begin(parser, parser->offset);
+					break;
+				case '/':
+					parser->prevstate = KVSTATEKEY;
+					parser->currentstate = KVSTATESLASH;
+					begin(parser, parser->charoffset);
+					break;
+				case '[':
+					error(parser, "conditionals must be on the same line as the key they apply to");
+					break;
+				default:
+					if (requirequotes) {
+						error(parser, "unexpected character (maybe you forgot to quote a string)");
+					} else {
+						//this character is the start of the key string
+						parser->quoted = false;
+						parser->overflow = false;
+						parser->directive = character == '#' && parser->bracecount == 0;
+						parser->currentstate = KVSTATEKEYSTRING;
+						begin(parser, parser->charoffset);
+					}
+					break;
+			}
+			break;
+		case KVSTATESUBKEY:
+			//newline, whitespace, open brace, or comment
+			switch (character) {
+				case '\n':
+				case '\t':
+				case ' ':
+					//no state change
+					break;
+				case '{':
+					parser->bracecount++;
+					parser->currentstate = KVSTATEKEY;
+					emitchar(parser, KVOPEN);
+					break;
+				case '/':
+					parser->prevstate = KVSTATESUBKEY;
+					parser->currentstate = KVSTATESLASH;
+					begin(parser, parser->charoffset);
+					break;
+				case '[':
+					error(parser, "conditionals must be on the same line as the key they apply to");
+					break;
+				default:
+					error(parser, "unexpected character (probably malformed or missing subkey)");
+					break;
+			}
+			break;
+		case KVSTATEKEYSTRING:
+			//anything except a newline
+			if (!parser->overflow && parser->charoffset - parser->tokenstart >= KVMAXSTRINGLENGTH) {
+				error(parser, "key string size limit exceeded");
+				parser->overflow = true;
+			}
+			switch (character) {
+				case '\t':
+					if (parser->quoted) {
+						if (parseescapes) {
+							error(parser, "unescaped tab in key string");
+						}
+					} else {
+						parser->space = true;
+						parser->currentstate = KVSTATEKEYSTRINGEND;
+					}
+					break;
+				case ' ':
+					if (!parser->quoted) {
+						parser->space = true;
+						parser->currentstate = KVSTATEKEYSTRINGEND;
+					}
+					break;
+				case '\n':
+					if (parser->quoted) {
+						if (!allowmultiline) {
+							error(parser, "unterminated key string");
+							parser->currentstate = KVSTATESUBKEY;
+						}
+					} else {
+						parser->currentstate = KVSTATESUBKEY;
+					}
+					break;
+				case '\\':
+					if (parseescapes) {
+						if (parser->quoted) {
+							parser->prevstate = KVSTATEKEYSTRING;
+							parser->currentstate = KVSTATESTRINGESCAPE;
+						} else {
+							error(parser, "backslash in unquoted key string (should you be parsing escape sequences?)");
+						}
+					}
+					break;
+				case '"':
+					if (parser->quoted) {
+						parser->space = false;
+						parser->currentstate = KVSTATEKEYSTRINGEND;
+					} else {
+						error(parser, "double-quote in unquoted key string");
+					}
+					break;
+				case '{':
+				case '}':
+					if (!parser->quoted) {
+						error(parser, "unexpected brace in key string (you cannot use braces in unquoted strings)");
+					}
+					break;
+				case '#':
+					if (parser->charoffset == parser->tokenstart && parser->bracecount == 0) {
+						parser->directive = true;
+					}
+					break;
+				default:
+					//no state change
+					break;
+			}
+			if (parser->currentstate == KVSTATEKEYSTRINGEND || parser->currentstate == KVSTATESUBKEY) {
+				emit(parser, parser->directive ? KVDIRECTIVE : KVKEY, parser->charoffset);
+				parser->directive = false;
+			}
+			break;
+		case KVSTATEKEYSTRINGEND:
+			//newline, whitespace, string, comment, or conditional
+			switch (character) {
+				case '\n':
+					parser->currentstate = KVSTATESUBKEY;
+					break;
+				case '\t':
+				case ' ':
+					parser->space = true;
+					break;
+				case '"':
+					if (!parser->space) {
+						error(parser, "missing space between key and value strings");
+					}
+					parser->quoted = true;
+					parser->overflow = false;
+					parser->currentstate = KVSTATEVALUESTRING;
+					begin(parser, parser->offset);
+					break;
+				case '/':
+					parser->prevstate = KVSTATEKEYSTRINGEND;
+					parser->currentstate = KVSTATESLASH;
+					begin(parser, parser->charoffset);
+					break;
+				case '[':
+					parser->prevstate = KVSTATEKEYSTRINGEND;
+					parser->currentstate = KVSTATECONDITIONAL;
+					begin(parser, parser->charoffset);
+					break;
+				case '{':
+					parser->bracecount++;
+					parser->currentstate = KVSTATEKEY;
+					error(parser, "braces should be on their own line, or quoted if they are part of a string");
+					emitchar(parser, KVOPEN);
+					break;
+				case '}':
+					error(parser, "unexpected close brace (possibly unquoted value string)");
+					break;
+				default:
+					if (requirequotes) {
+						error(parser, "unexpected character after key string (possibly unquoted value string)");
+					} else {
+						//this character is the start of the value string
+						parser->quoted = false;
+						parser->overflow = false;
+						parser->currentstate = KVSTATEVALUESTRING;
+						begin(parser, parser->charoffset);
+					}
+					break;
+			}
+			break;
+		case KVSTATEVALUESTRING:
+			//anything except a newline
+			if (!parser->overflow && parser->charoffset - parser->tokenstart >= KVMAXSTRINGLENGTH) {
+				error(parser, "value string size limit exceeded");
+				parser->overflow = true;
+			}
+			switch (character) {
+				case '\t':
+					if (parser->quoted) {
+						if (!allowmultiline && parseescapes) {
+							error(parser, "unescaped tab in value string");
+						}
+					} else {
+						parser->space = true;
+						parser->currentstate = KVSTATEVALUESTRINGEND;
+					}
+					break;
+				case ' ':
+					if (!parser->quoted) {
+						parser->space = true;
+						parser->currentstate = KVSTATEVALUESTRINGEND;
+					}
+					break;
+				case '\n':
+					if (parser->quoted) {
+						if (!allowmultiline) {
+							error(parser, "unterminated value string");
+							parser->currentstate = KVSTATEKEY;
+						}
+					} else {
+						parser->currentstate = KVSTATEKEY;
+					}
+					break;
+				case '\\':
+					if (parseescapes) {
+						if (parser->quoted) {
+							parser->prevstate = KVSTATEVALUESTRING;
+							parser->currentstate = KVSTATESTRINGESCAPE;
+						} else {
+							error(parser, "backslash in unquoted value string (should you be parsing escape sequences?)");
+						}
+					}
+					break;
+				case '"':
+					parser->currentstate = KVSTATEVALUESTRINGEND;
+					break;
+				case '}':
+				case '{':
+					if (!parser->quoted) {
+						error(parser, "unexpected brace in value string (you cannot use braces in unquoted strings)");
+					}
+					break;
+				default:
+					//no state change
+					break;
+			}
+			if (parser->currentstate == KVSTATEVALUESTRINGEND || parser->currentstate == KVSTATEKEY) {
+				emit(parser, KVVALUE, parser->charoffset);
+			}
+			break;
+		case KVSTATEVALUESTRINGEND:
+			//whitespace, newline, comment, or conditional
+			switch (character) {
+				case '\t':
+				case ' ':
+					//no state change
+					break;
+				case '\n':
+					parser->currentstate = KVSTATEKEY;
+					break;
+				case '/':
+					parser->prevstate = KVSTATEVALUESTRINGEND;
+					parser->currentstate = KVSTATESLASH;
+					begin(parser, parser->charoffset);
+					break;
+				case '[':
+					parser->prevstate = KVSTATEVALUESTRINGEND;
+					parser->currentstate = KVSTATECONDITIONAL;
+					begin(parser, parser->charoffset);
+					break;
+				default:
+					error(parser, "unexpected character after value string (maybe you forgot to use quotes)");
+					break;
+			}
+			break;
+		case KVSTATESTRINGESCAPE:
+			//backslash, t, n, quote, underscore
+			parser->currentstate = parser->prevstate;
+			switch (character) {
+				case '\\':
+				case 't':
+				case 'n':
+				case '"':
+					//no state change
+					break;
+				case '_':
+					if (parser->flags & KVIGNORESHRUG) {
+						break;
+					}
+					//else intentional fallthrough
+				default:
+					if (!(parser->lastbserror == parser->linecount)) {
+						parser->lastbserror = parser->linecount;
+						switch (parser->prevstate) {
+							case KVSTATEKEYSTRING:
+								if (parser->linecount != 1 || (parser->flags & KVCHECKROOTESCAPES)) {
+									error(parser, "invalid escape sequence in key string");
+								}
+								break;
+							case KVSTATEVALUESTRING:
+								error(parser, "invalid escape sequence in value string");
+								break;
+							default:
+								error(parser, BUGMESSAGE);
+								break;
+						}
+					}
+					break;
+			}
+			break;
+		case KVSTATESLASH:
+			//forward slash
+			switch (character) {
+				case '/':
+					parser->currentstate = KVSTATELINECOMMENT;
+					break;
+				case '*':
+					if (parser->flags & KVBLOCKCOMMENTS) {
+						parser->currentstate = KVSTATEBLOCKCOMMENT;
+					} else {
+						parser->currentstate = KVSTATELINECOMMENT;
+						error(parser, "only line comments are allowed. block comments act as line comments in most games and can cause unexpected behavior");
+					}
+					break;
+				default:
+					parser->currentstate = KVSTATELINECOMMENT;
+					error(parser, "bogus comment");
+					break;
+			}
+			break;
+		case KVSTATELINECOMMENT:
+			//ignore the rest of the line
+			switch (character) {
+				case '\n':
+					emit(parser, KVCOMMENT, parser->charoffset);
+					switch (parser->prevstate) {
+						case KVSTATEKEY:
+						case KVSTATEVALUESTRINGEND:
+							parser->currentstate = KVSTATEKEY;
+							break;
+						case KVSTATESUBKEY:
+						case KVSTATEKEYSTRINGEND:
+							parser->currentstate = KVSTATESUBKEY;
+							break;
+						case KVSTATEENDOFROOT:
+							parser->currentstate = KVSTATEENDOFROOT;
+							break;
+						default:
+							bug(parser, "unexpected parser state in linecomment");
+							break;
+					}
+					break;
+				default:
+					//no state change
+					break;
+			}
+			break;
+		case KVSTATEBLOCKCOMMENT:
+			//ignore until */
+			switch (character) {
+				case '*':
+					parser->currentstate = KVSTATEBLOCKASTERISK;
+					break;
+				default:
+					//no state change
+					break;
+			}
+			break;
+		case KVSTATEBLOCKASTERISK:
+			//asterisk in block comment
+			switch (character) {
+				case '*':
+					//no state change
+					break;
+				case '/':
+					emit(parser, KVCOMMENT, parser->offset);
+					parser->currentstate = parser->prevstate;
+					break;
+				default:
+					parser->currentstate = KVSTATEBLOCKCOMMENT;
+					break;
+			}
+			break;
+		case KVSTATECONDITIONAL:
+			//ignore until ]
+			switch (character) {
+				case '\n':
+					error(parser, "unterminated conditional");
+					switch (parser->prevstate) {
+						case KVSTATEVALUESTRINGEND:
+							parser->currentstate = KVSTATEKEY;
+							break;
+						case KVSTATEKEYSTRINGEND:
+							parser->currentstate = KVSTATESUBKEY;
+							break;
+						default:
+							bug(parser, "unexpected parser state in conditional");
+							break;
+					}
+					break;
+				case ']':
+					emit(parser, KVCONDITIONAL, parser->offset);
+					parser->currentstate = KVSTATECONDITIONALEND;
+					break;
+			}
+			break;
+		case KVSTATECONDITIONALEND:
+			//whitespace, newline, or comment
+			switch (character) {
+				case ' ':
+				case '\t':
+					//no state change
+					break;
+				case '\n':
+					switch (parser->prevstate) {
+						case KVSTATEVALUESTRINGEND:
+							parser->currentstate = KVSTATEKEY;
+							break;
+						case KVSTATEKEYSTRINGEND:
+							parser->currentstate = KVSTATESUBKEY;
+							break;
+						default:
+							bug(parser, "unexpected parser state in conditionalend");
+							break;
+					}
+					break;
+				case '[':
+					error(parser, "only one conditional may be used per key");
+					break;
+				case '/':
+					parser->currentstate = KVSTATESLASH;
+					begin(parser, parser->charoffset);
+					break;
+				default:
+					error(parser, "unexpected character after conditional");
+					break;
+			}
+			break;
+		case KVSTATEENDOFROOT:
+			//whitespace, newline, or comment
+			switch (character) {
+				case ' ':
+				case '\t':
+				case '\n':
+					//no state change
+					break;
+				case '/':
+					parser->prevstate = KVSTATEENDOFROOT;
+					parser->currentstate = KVSTATESLASH;
+					begin(parser, parser->charoffset);
+					break;
+				default:
+					error(parser, "unexpected data after end of root key");
+					break;
+			}
+	}
+}
+
+kvresult kvfeed(kvparser* parser, const char* data, size_t length) {
+	size_t i;
+	if (parser->stopped) {
+		return KVSTOPPED;
+	}
+	if (parser->failed) {
+		return KVFAILED;
+	}
+	parser->chunk = data;
+	parser->chunkbase = parser->offset;
+	for (i = 0; i < length; i++) {
+		int character = (unsigned char)data[i];
+		parser->offset++;
+		if (parser->pendingcr) {
+			//the carriage return starts the character, its newline ends it
+			parser->pendingcr = false;
+			if (character != '\n') {
+				parser->charoffset = parser->offset - 1;
+				error(parser, "unexpected carriage return, stopping");
+				parser->failed = true;
+				parser->chunk = NULL;
+				return parser->stopped ? KVSTOPPED : KVFAILED;
+			}
+		} else {
+			parser->charoffset = parser->offset - 1;
+			if (character == '\r') {
+				parser->pendingcr = true;
+				continue;
+			}
+		}
+		if (character == '\n') {
+			//a newline will always increase the linecount regardless of errors
+			parser->linecount++;
+		}
+		step(parser, character);
+		if (character == '\n') {
+			parser->linestart = parser->offset;
+		}
+		if (parser->stopped) {
+			return KVSTOPPED;
+		}
+	}
+	//keep the part of an unfinished token that is in this chunk
+	if (intoken(parser)) {
+		uint64_t start = parser->tokenstart > parser->chunkbase ? parser->tokenstart : parser->chunkbase;
+		if (start < parser->offset && !scratchappend(parser, data + (start - parser->chunkbase), (size_t)(parser->offset - start))) {
+			return KVFAILED;
+		}
+	}
+	parser->chunk = NULL;
+	parser->chunkbase = parser->offset;
+	return KVOK;
+}
+
+kvresult kvfinish(kvparser* parser) {
+	if (parser->stopped) {
+		return KVSTOPPED;
+	}
+	parser->chunk = "";
+	parser->chunkbase = parser->offset;
+	if (parser->pendingcr) {
+		parser->pendingcr = false;
+		parser->charoffset = parser->offset - 1;
+		error(parser, "unexpected carriage return, stopping");
+		parser->failed = true;
+	} else if (!parser->failed) {
+		//data after the last newline
+		if (parser->currentstate == KVSTATEVALUESTRING && !parser->quoted) {
+			emit(parser, KVVALUE, parser->offset);
+			parser->currentstate = KVSTATEKEY;
+		} else if (parser->currentstate == KVSTATELINECOMMENT) {
+			emit(parser, KVCOMMENT, parser->offset);
+		}
+	}
+	if (parser->bracecount > 0) {
+		fileerror(parser, "unclosed key");
+	}
+	if (parser->currentstate == KVSTATESUBKEY) {
+		fileerror(parser, "trailing key string");
+	}
+	parser->chunk = NULL;
+	if (parser->stopped) {
+		return KVSTOPPED;
+	}
+	return parser->failed ? KVFAILED : KVOK;
+}
@@ -0,0 +1,155 @@
+/*
+ * kvparse.h - event based tokenizer for KeyValues files
+ *
+ * Copyright (c) 2015-2016 Sam Heybey
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef KVPARSE_H
+#define KVPARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define KVMAXSTRINGLENGTH 1024
+
+/*
+ * parser flags, matching the kvlint command line options
+ */
+#define KVREQUIREQUOTES 0x01    //-q
+#define KVALLOWMULTILINE 0x02   //-m
+#define KVPARSEESCAPES 0x04     //-e
+#define KVIGNORESHRUG 0x08      //-s
+#define KVCHECKROOTESCAPES 0x10 //not -w
+#define KVBLOCKCOMMENTS 0x20    //-b
+#define KVMULTIPLEROOT 0x40     //-r
+
+typedef enum {
+	KVSTATEKEY, KVSTATESUBKEY,
+	KVSTATEKEYSTRING, KVSTATEKEYSTRINGEND,
+	KVSTATEVALUESTRING, KVSTATEVALUESTRINGEND,
+	KVSTATESTRINGESCAPE,
+	KVSTATESLASH, KVSTATELINECOMMENT, KVSTATEBLOCKCOMMENT, KVSTATEBLOCKASTERISK,
+	KVSTATECONDITIONAL, KVSTATECONDITIONALEND,
+	KVSTATEENDOFROOT
+} kvstate;
+
+typedef enum {
+	KVKEY,         //key string, without quotes
+	KVVALUE,       //value string, without quotes
+	KVOPEN,        //open brace of a subkey
+	KVCLOSE,       //close brace of a subkey
+	KVCONDITIONAL, //conditional including brackets, applies to the last key or value
+	KVCOMMENT,     //comment including the slashes or asterisks
+	KVDIRECTIVE,   //root level key string starting with '#', the next value is its argument
+	KVERROR        //text is a message; line is 0 for problems with the file as a whole
+} kveventtype;
+
+/*
+ * text points into the buffer passed to kvfeed when the token lies within
+ * it, and into the parser's own buffer when it spans several calls. either
+ * way it is only valid during the callback. strings are raw, escape
+ * sequences are not processed. line and column are 1-based and refer to
+ * the first byte of the span.
+ */
+typedef struct {
+	kveventtype type;
+	const char* text;
+	size_t length;
+	uint64_t offset;
+	int line;
+	int column;
+	bool quoted;
+} kvevent;
+
+/*
+ * return nonzero to stop parsing
+ */
+typedef int (*kvhandler)(const kvevent* event, void* context);
+
+typedef enum {
+	KVOK,      //ready for more input
+	KVSTOPPED, //the handler asked to stop
+	KVFAILED   //input cannot be parsed any further
+} kvresult;
+
+/*
+ * parser state. linecount, currentstate, bracecount, offset and
+ * internalerror (set when the parser reached a state it should never be
+ * in) may be read between calls; everything else is private.
+ */
+typedef struct {
+	unsigned flags;
+	kvhandler handler;
+	void* context;
+
+	int bracecount;
+	int linecount;
+	int lastbserror;
+	uint64_t offset;
+	uint64_t charoffset;
+	uint64_t linestart;
+
+	bool space;
+	bool quoted;
+	bool overflow;
+	bool directive;
+	bool pendingcr;
+	bool stopped;
+	bool failed;
+	bool internalerror;
+
+	kvstate prevstate;
+	kvstate currentstate;
+
+	//token currently being read
+	uint64_t tokenstart;
+	int tokenline;
+	int tokencolumn;
+
+	//input of the current kvfeed call
+	const char* chunk;
+	uint64_t chunkbase;
+
+	//bytes of a token that started in an earlier kvfeed call
+	char* scratch;
+	size_t scratchlength;
+	size_t scratchcapacity;
+} kvparser;
+
+void kvinit(kvparser* parser, unsigned flags, kvhandler handler, void* context);
+
+/*
+ * continue parsing as if the data before offset had already been fed and
+ * had left the parser between root keys in the given state
+ */
+void kvresume(kvparser* parser, uint64_t offset, int linecount, kvstate state);
+
+kvresult kvfeed(kvparser* parser, const char* data, size_t length);
+
+/*
+ * signal the end of input and report unterminated constructs
+ */
+kvresult kvfinish(kvparser* parser);
+
+void kvfree(kvparser* parser);
+
+#endif
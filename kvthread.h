@@ -0,0 +1,104 @@
+/*
+ * kvthread.h - minimal threading wrappers for windows and POSIX
+ *
+ * Copyright (c) 2015-2016 Sam Heybey
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef KVTHREAD_H
+#define KVTHREAD_H
+
+#include <stdbool.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+
+typedef CRITICAL_SECTION kvmutex;
+typedef CONDITION_VARIABLE kvcond;
+typedef HANDLE kvthread;
+typedef DWORD kvthreadresult;
+#define KVTHREADCALL WINAPI
+
+#define mutexinit(m) InitializeCriticalSection(m)
+#define mutexlock(m) EnterCriticalSection(m)
+#define mutexunlock(m) LeaveCriticalSection(m)
+#define mutexdestroy(m) DeleteCriticalSection(m)
+
+#define condinit(c) InitializeConditionVariable(c)
+#define condwait(c, m) SleepConditionVariableCS(c, m, INFINITE)
+#define condsignal(c) WakeConditionVariable(c)
+#define conddestroy(c) ((void)(c))
+
+//returns the value before the increment
+#define atomicincrement(p) (InterlockedIncrement(p) - 1)
+
+static inline bool threadstart(kvthread* thread, kvthreadresult (KVTHREADCALL *function)(void*), void* argument) {
+	*thread = CreateThread(NULL, 0, function, argument, 0, NULL);
+	return *thread != NULL;
+}
+
+static inline void threadjoin(kvthread thread) {
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+static inline int processorcount(void) {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+}
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_mutex_t kvmutex;
+typedef pthread_cond_t kvcond;
+typedef pthread_t kvthread;
+typedef void* kvthreadresult;
+#define KVTHREADCALL
+
+#define mutexinit(m) pthread_mutex_init(m, NULL)
+#define mutexlock(m) pthread_mutex_lock(m)
+#define mutexunlock(m) pthread_mutex_unlock(m)
+#define mutexdestroy(m) pthread_mutex_destroy(m)
+
+#define condinit(c) pthread_cond_init(c, NULL)
+#define condwait(c, m) pthread_cond_wait(c, m)
+#define condsignal(c) pthread_cond_signal(c)
+#define conddestroy(c) pthread_cond_destroy(c)
+
+//returns the value before the increment
+#define atomicincrement(p) __sync_fetch_and_add(p, 1)
+
+static inline bool threadstart(kvthread* thread, kvthreadresult (KVTHREADCALL *function)(void*), void* argument) {
+	return pthread_create(thread, NULL, function, argument) == 0;
+}
+
+static inline void threadjoin(kvthread thread) {
+	pthread_join(thread, NULL);
+}
+
+static inline int processorcount(void) {
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+}
+#endif
+
+#endif
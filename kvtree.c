@@ -0,0 +1,701 @@
+/*
+ * kvtree.c - KeyValues trees with #base merging
+ *
+ * Copyright (c) 2015-2016 Sam Heybey
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "kvtree.h"
+
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGN 8
+
+struct kvblock {
+	kvblock* next;
+	size_t used;
+	size_t size;
+	char data[];
+};
+
+void* kvalloc(kvarena* arena, size_t size) {
+	kvblock* block = arena->blocks;
+	void* result;
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if (block == NULL || block->size - block->used < size) {
+		size_t blocksize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+		block = malloc(sizeof(kvblock) + blocksize);
+		if (block == NULL) {
+			return NULL;
+		}
+		block->used = 0;
+		block->size = blocksize;
+		//a block for one large allocation goes behind the current one so the rest of that stays usable
+		if (arena->blocks != NULL && blocksize > ARENA_BLOCK_SIZE) {
+			block->next = arena->blocks->next;
+			arena->blocks->next = block;
+		} else {
+			block->next = arena->blocks;
+			arena->blocks = block;
+		}
+	}
+	result = block->data + block->used;
+	block->used += size;
+	return result;
+}
+
+void kvarenafree(kvarena* arena) {
+	while (arena->blocks != NULL) {
+		kvblock* next = arena->blocks->next;
+		free(arena->blocks);
+		arena->blocks = next;
+	}
+}
+
+static const char* arenastring(kvarena* arena, const char* text, size_t length) {
+	char* copy = kvalloc(arena, length + 1);
+	if (copy != NULL) {
+		memcpy(copy, text, length);
+		copy[length] = '\0';
+	}
+	return copy;
+}
+
+static bool grow(void** data, size_t* capacity, size_t needed, size_t size) {
+	size_t newcapacity;
+	void* newdata;
+	if (needed <= *capacity) {
+		return true;
+	}
+	newcapacity = *capacity == 0 ? 16 : *capacity * 2;
+	while (newcapacity < needed) {
+		newcapacity *= 2;
+	}
+	newdata = realloc(*data, newcapacity * size);
+	if (newdata == NULL) {
+		return false;
+	}
+	*data = newdata;
+	*capacity = newcapacity;
+	return true;
+}
+
+static uint32_t namehash(const char* name) {
+	uint32_t hash = 2166136261u;
+	for (; *name != '\0'; name++) {
+		hash = (hash ^ (uint32_t)tolower((unsigned char)*name)) * 16777619u;
+	}
+	return hash;
+}
+
+static bool namesequal(const char* a, const char* b) {
+	while (*a != '\0' && tolower((unsigned char)*a) == tolower((unsigned char)*b)) {
+		a++;
+		b++;
+	}
+	return tolower((unsigned char)*a) == tolower((unsigned char)*b);
+}
+
+void kvbuildinit(kvbuilder* builder, kvarena* arena, int file) {
+	memset(builder, 0, sizeof(*builder));
+	builder->arena = arena;
+	builder->file = file;
+}
+
+static kvnode* addnode(kvbuilder* builder, const char* value, int line) {
+	kvnode* node = kvalloc(builder->arena, sizeof(kvnode));
+	if (node == NULL || !grow((void**)&builder->pending, &builder->pendingcapacity, builder->pendingcount + 1, sizeof(kvnode*))) {
+		builder->failed = true;
+		return NULL;
+	}
+	node->name = builder->name != NULL ? builder->name : "";
+	node->hash = namehash(node->name);
+	node->value = value;
+	node->conditional = builder->conditional;
+	node->children = NULL;
+	node->count = 0;
+	node->base = NULL;
+	node->file = builder->file;
+	node->line = line;
+	builder->pending[builder->pendingcount++] = node;
+	builder->name = NULL;
+	builder->conditional = NULL;
+	builder->last = node;
+	return node;
+}
+
+static void closenode(kvbuilder* builder) {
+	kvnode* node = builder->open[--builder->depth];
+	size_t start = builder->starts[builder->depth];
+	node->count = builder->pendingcount - start;
+	if (node->count > 0) {
+		node->children = kvalloc(builder->arena, node->count * sizeof(kvnode*));
+		if (node->children == NULL) {
+			builder->failed = true;
+			return;
+		}
+		memcpy(node->children, builder->pending + start, node->count * sizeof(kvnode*));
+	}
+	builder->pendingcount = start;
+	builder->last = node;
+}
+
+void kvbuildevent(kvbuilder* builder, const kvevent* event) {
+	const char* text;
+	kvnode* node;
+	if (builder->failed) {
+		return;
+	}
+	switch (event->type) {
+		case KVKEY:
+		case KVDIRECTIVE:
+			builder->name = arenastring(builder->arena, event->text, event->length);
+			builder->nameline = event->line;
+			builder->conditional = NULL;
+			builder->directive = event->type == KVDIRECTIVE;
+			if (builder->name == NULL) {
+				builder->failed = true;
+			}
+			break;
+		case KVVALUE:
+			if (builder->name == NULL) {
+				break;
+			}
+			text = arenastring(builder->arena, event->text, event->length);
+			if (text == NULL) {
+				builder->failed = true;
+			} else if (builder->directive) {
+				//#include appends root keys rather than merging, which is not modeled
+				if (namesequal(builder->name, "#base")) {
+					if (!grow((void**)&builder->bases, &builder->basecapacity, builder->basecount + 1, sizeof(kvbase))) {
+						builder->failed = true;
+						break;
+					}
+					builder->bases[builder->basecount].path = text;
+					builder->bases[builder->basecount].line = builder->nameline;
+					builder->basecount++;
+				}
+				builder->name = NULL;
+				builder->directive = false;
+			} else {
+				addnode(builder, text, builder->nameline);
+			}
+			break;
+		case KVOPEN:
+			if (builder->depth == builder->opencapacity) {
+				size_t capacity = builder->opencapacity;
+				size_t* starts;
+				if (!grow((void**)&builder->open, &builder->opencapacity, builder->depth + 1, sizeof(kvnode*))) {
+					builder->failed = true;
+					break;
+				}
+				starts = realloc(builder->starts, builder->opencapacity * sizeof(size_t));
+				if (starts == NULL) {
+					builder->opencapacity = capacity;
+					builder->failed = true;
+					break;
+				}
+				builder->starts = starts;
+			}
+			node = addnode(builder, NULL, builder->name != NULL ? builder->nameline : event->line);
+			if (node != NULL) {
+				builder->open[builder->depth] = node;
+				builder->starts[builder->depth] = builder->pendingcount;
+				builder->depth++;
+			}
+			builder->directive = false;
+			break;
+		case KVCLOSE:
+			if (builder->depth > 0) {
+				closenode(builder);
+			}
+			break;
+		case KVCONDITIONAL:
+			text = arenastring(builder->arena, event->text, event->length);
+			if (text == NULL) {
+				builder->failed = true;
+			} else if (builder->name != NULL) {
+				builder->conditional = text;
+			} else if (builder->last != NULL) {
+				builder->last->conditional = text;
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+void kvbuildfinish(kvbuilder* builder) {
+	while (builder->depth > 0 && !builder->failed) {
+		closenode(builder);
+	}
+	if (builder->failed) {
+		builder->rootcount = 0;
+		return;
+	}
+	builder->rootcount = builder->pendingcount;
+	if (builder->rootcount > 0) {
+		builder->roots = kvalloc(builder->arena, builder->rootcount * sizeof(kvnode*));
+		if (builder->roots == NULL) {
+			builder->failed = true;
+			builder->rootcount = 0;
+			return;
+		}
+		memcpy(builder->roots, builder->pending, builder->rootcount * sizeof(kvnode*));
+	}
+}
+
+void kvbuildfree(kvbuilder* builder) {
+	free(builder->pending);
+	free(builder->open);
+	free(builder->starts);
+	free(builder->bases);
+	builder->pending = NULL;
+	builder->open = NULL;
+	builder->starts = NULL;
+	builder->bases = NULL;
+}
+
+/*
+ * memo tables are open addressed on a pair of pointers and kept at most
+ * half full
+ */
+static kvmemoentry* memoslot(kvmemoentry* entries, size_t capacity, const void* first, const void* second) {
+	uint64_t hash = (uint64_t)(uintptr_t)first * 0x9e3779b97f4a7c15ull ^ (uint64_t)(uintptr_t)second * 0xc2b2ae3d27d4eb4full;
+	size_t slot = (size_t)(hash ^ hash >> 32) & (capacity - 1);
+	while (entries[slot].value != NULL && (entries[slot].first != first || entries[slot].second != second)) {
+		slot = (slot + 1) & (capacity - 1);
+	}
+	return &entries[slot];
+}
+
+static const void* memofind(const kvmemo* memo, const void* first, const void* second) {
+	if (memo->capacity == 0) {
+		return NULL;
+	}
+	return memoslot(memo->entries, memo->capacity, first, second)->value;
+}
+
+static bool memoadd(kvmemo* memo, const void* first, const void* second, const void* value) {
+	kvmemoentry* entry;
+	if ((memo->count + 1) * 2 > memo->capacity) {
+		size_t capacity = memo->capacity == 0 ? 64 : memo->capacity * 2;
+		kvmemoentry* entries = calloc(capacity, sizeof(kvmemoentry));
+		size_t i;
+		if (entries == NULL) {
+			return false;
+		}
+		for (i = 0; i < memo->capacity; i++) {
+			if (memo->entries[i].value != NULL) {
+				*memoslot(entries, capacity, memo->entries[i].first, memo->entries[i].second) = memo->entries[i];
+			}
+		}
+		free(memo->entries);
+		memo->entries = entries;
+		memo->capacity = capacity;
+	}
+	entry = memoslot(memo->entries, memo->capacity, first, second);
+	entry->first = first;
+	entry->second = second;
+	entry->value = value;
+	memo->count++;
+	return true;
+}
+
+void kvmergerinit(kvmerger* merger, kvarena* arena, kvconflicthandler conflict, void* context) {
+	memset(merger, 0, sizeof(*merger));
+	merger->arena = arena;
+	merger->conflict = conflict;
+	merger->context = context;
+}
+
+void kvmergerfree(kvmerger* merger) {
+	free(merger->lookups.entries);
+	free(merger->chains.entries);
+	merger->lookups.entries = NULL;
+	merger->chains.entries = NULL;
+}
+
+/*
+ * slots hold an index into children plus one, 0 marks an empty slot
+ */
+static size_t* findslot(size_t* slots, size_t mask, const kvnode** children, const kvnode* child) {
+	size_t slot = child->hash & mask;
+	while (slots[slot] != 0) {
+		const kvnode* other = children[slots[slot] - 1];
+		if (other->hash == child->hash && namesequal(other->name, child->name)) {
+			break;
+		}
+		slot = (slot + 1) & mask;
+	}
+	return &slots[slot];
+}
+
+static size_t slotmask(size_t count) {
+	size_t mask;
+	for (mask = 15; mask < count * 2; mask = mask * 2 + 1);
+	return mask;
+}
+
+/*
+ * a temporary table of the first child with each name
+ */
+static size_t* nameslots(const kvnode** children, size_t count, size_t* mask) {
+	size_t* slots;
+	size_t i;
+	*mask = slotmask(count);
+	slots = calloc(*mask + 1, sizeof(size_t));
+	if (slots == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		size_t* slot = findslot(slots, *mask, children, children[i]);
+		if (*slot == 0) {
+			*slot = i + 1;
+		}
+	}
+	return slots;
+}
+
+/*
+ * what a node adds when it is merged in as a base. entries are its
+ * children with duplicates merged into the first, since keys appended from
+ * a base are found again by later ones. a key that overrides one of them
+ * is merged with each duplicate in turn instead, as a value and a subkey
+ * with the same name do not merge.
+ */
+typedef struct {
+	const kvnode** entries;
+	size_t count;
+	const kvnode** children; //grouped by entry, in order within each group
+	size_t* starts;          //entry i was made from children starts[i] to starts[i + 1] - 1
+	size_t* slots;
+	size_t mask;
+} kvlookup;
+
+static const kvlookup* lookup(kvmerger* merger, const kvnode* node);
+
+/*
+ * the children of a node: its own, then the entries of its base that none
+ * of its own shadow. the list is malloced.
+ */
+static const kvnode** effective(kvmerger* merger, const kvnode* node, size_t* count) {
+	const kvlookup* base = NULL;
+	const kvnode** children;
+	size_t total = node->count;
+	size_t i;
+
+	if (node->base != NULL) {
+		base = lookup(merger, node->base);
+		if (base == NULL) {
+			return NULL;
+		}
+		total += base->count;
+	}
+	children = malloc((total > 0 ? total : 1) * sizeof(kvnode*));
+	if (children == NULL) {
+		return NULL;
+	}
+	if (node->count > 0) {
+		memcpy(children, node->children, node->count * sizeof(kvnode*));
+	}
+	*count = node->count;
+	if (base != NULL && base->count > 0) {
+		size_t mask;
+		size_t* slots = nameslots(node->children, node->count, &mask);
+		if (slots == NULL) {
+			free(children);
+			return NULL;
+		}
+		for (i = 0; i < base->count; i++) {
+			if (*findslot(slots, mask, node->children, base->entries[i]) == 0) {
+				children[(*count)++] = base->entries[i];
+			}
+		}
+		free(slots);
+	}
+	return children;
+}
+
+/*
+ * built once per node, so a base shared by many files is only indexed once
+ */
+static const kvlookup* lookup(kvmerger* merger, const kvnode* node) {
+	const kvlookup* found = memofind(&merger->lookups, node, NULL);
+	kvlookup* result;
+	const kvnode** children;
+	size_t* groups;
+	size_t count;
+	size_t i;
+
+	if (found != NULL) {
+		return found;
+	}
+	children = effective(merger, node, &count);
+	if (children == NULL) {
+		return NULL;
+	}
+	groups = malloc((count > 0 ? count : 1) * sizeof(size_t));
+	result = kvalloc(merger->arena, sizeof(kvlookup));
+	if (result != NULL) {
+		result->mask = slotmask(count);
+		result->entries = kvalloc(merger->arena, count * sizeof(kvnode*));
+		result->children = kvalloc(merger->arena, count * sizeof(kvnode*));
+		result->starts = kvalloc(merger->arena, (count + 1) * sizeof(size_t));
+		result->slots = kvalloc(merger->arena, (result->mask + 1) * sizeof(size_t));
+	}
+	if (groups == NULL || result == NULL || result->entries == NULL || result->children == NULL ||
+		result->starts == NULL || result->slots == NULL) {
+		free(groups);
+		free(children);
+		return NULL;
+	}
+	memset(result->slots, 0, (result->mask + 1) * sizeof(size_t));
+	memset(result->starts, 0, (count + 1) * sizeof(size_t));
+	result->count = 0;
+	for (i = 0; i < count; i++) {
+		size_t* slot = findslot(result->slots, result->mask, result->entries, children[i]);
+		if (*slot == 0) {
+			result->entries[result->count++] = children[i];
+			*slot = result->count;
+		}
+		groups[i] = *slot - 1;
+		result->starts[*slot]++;
+	}
+	for (i = 0; i < result->count; i++) {
+		result->starts[i + 1] += result->starts[i];
+	}
+	//starts[g] counts up while group g is filled and ends where group g + 1 begins
+	for (i = 0; i < count; i++) {
+		result->children[result->starts[groups[i]]++] = children[i];
+	}
+	for (i = result->count; i > 0; i--) {
+		result->starts[i] = result->starts[i - 1];
+	}
+	result->starts[0] = 0;
+	free(groups);
+	free(children);
+
+	for (i = 0; i < result->count; i++) {
+		size_t j;
+		for (j = result->starts[i] + 1; j < result->starts[i + 1]; j++) {
+			result->entries[i] = kvmerge(merger, result->entries[i], result->children[j]);
+			if (result->entries[i] == NULL) {
+				return NULL;
+			}
+		}
+	}
+	if (!memoadd(&merger->lookups, node, NULL, result)) {
+		return NULL;
+	}
+	return result;
+}
+
+/*
+ * merge each child of base that entry was made from into node
+ */
+static const kvnode* mergeentry(kvmerger* merger, const kvnode* node, const kvlookup* base, size_t entry) {
+	size_t i;
+	for (i = base->starts[entry]; i < base->starts[entry + 1] && node != NULL; i++) {
+		node = kvmerge(merger, node, base->children[i]);
+	}
+	return node;
+}
+
+/*
+ * the base of a node that already has one, after another is merged under
+ * it: the entries of the first with matching entries of the second merged
+ * in, then the rest of the second. files with the same #base lines share it.
+ */
+static const kvnode* chain(kvmerger* merger, const kvnode* first, const kvnode* second) {
+	const kvnode* found = memofind(&merger->chains, first, second);
+	const kvlookup* firstlookup;
+	const kvlookup* secondlookup;
+	const kvnode** children;
+	kvnode* result;
+	size_t i;
+
+	if (found != NULL) {
+		return found;
+	}
+	firstlookup = lookup(merger, first);
+	secondlookup = firstlookup != NULL ? lookup(merger, second) : NULL;
+	if (secondlookup == NULL) {
+		return NULL;
+	}
+	if (secondlookup->count == 0) {
+		return first;
+	}
+	children = kvalloc(merger->arena, firstlookup->count * sizeof(kvnode*));
+	result = kvalloc(merger->arena, sizeof(kvnode));
+	if (children == NULL || result == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < firstlookup->count; i++) {
+		size_t* slot = findslot(secondlookup->slots, secondlookup->mask, secondlookup->entries, firstlookup->entries[i]);
+		children[i] = firstlookup->entries[i];
+		if (*slot != 0) {
+			children[i] = mergeentry(merger, children[i], secondlookup, *slot - 1);
+			if (children[i] == NULL) {
+				return NULL;
+			}
+		}
+	}
+	*result = *first;
+	result->children = children;
+	result->count = firstlookup->count;
+	result->base = second;
+	if (!memoadd(&merger->chains, first, second, result)) {
+		return NULL;
+	}
+	return result;
+}
+
+const kvnode* kvmerge(kvmerger* merger, const kvnode* node, const kvnode* base) {
+	const kvlookup* baselookup;
+	const kvnode** children = NULL;
+	const kvnode* newbase;
+	kvnode* merged;
+	size_t* slots;
+	size_t mask;
+	size_t matched = 0;
+	size_t i;
+
+	if (node == NULL) {
+		return base;
+	}
+	if (node->value != NULL || base->value != NULL) {
+		if ((node->value == NULL) != (base->value == NULL)) {
+			merger->conflict(node, base, merger->context);
+		}
+		return node;
+	}
+	baselookup = lookup(merger, base);
+	if (baselookup == NULL) {
+		return NULL;
+	}
+	if (baselookup->count == 0) {
+		return node;
+	}
+
+	//the list of children is only copied when one of them changes, keys only in base stay behind the base pointer
+	slots = nameslots(node->children, node->count, &mask);
+	if (slots == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < node->count; i++) {
+		const kvnode* child = node->children[i];
+		const kvnode* result;
+		size_t* slot;
+		//later duplicates are never found, like KeyValues::FindKey
+		if (*findslot(slots, mask, node->children, child) != i + 1) {
+			continue;
+		}
+		slot = findslot(baselookup->slots, baselookup->mask, baselookup->entries, child);
+		if (*slot == 0) {
+			continue;
+		}
+		matched++;
+		result = mergeentry(merger, child, baselookup, *slot - 1);
+		if (result == NULL) {
+			free(slots);
+			return NULL;
+		}
+		if (result != child) {
+			if (children == NULL) {
+				children = kvalloc(merger->arena, node->count * sizeof(kvnode*));
+				if (children == NULL) {
+					free(slots);
+					return NULL;
+				}
+				memcpy(children, node->children, node->count * sizeof(kvnode*));
+			}
+			children[i] = result;
+		}
+	}
+	free(slots);
+
+	//when node already has a base, the new one goes under it
+	if (matched == baselookup->count) {
+		newbase = node->base;
+	} else if (node->base == NULL) {
+		newbase = base;
+	} else {
+		newbase = chain(merger, node->base, base);
+		if (newbase == NULL) {
+			return NULL;
+		}
+	}
+	if (children == NULL && newbase == node->base) {
+		return node;
+	}
+	merged = kvalloc(merger->arena, sizeof(kvnode));
+	if (merged == NULL) {
+		return NULL;
+	}
+	*merged = *node;
+	if (children != NULL) {
+		merged->children = children;
+	}
+	merged->base = newbase;
+	return merged;
+}
+
+static void indent(FILE* out, int depth) {
+	int i;
+	for (i = 0; i < depth; i++) {
+		fputc('\t', out);
+	}
+}
+
+bool kvdump(kvmerger* merger, FILE* out, const kvnode* node, int depth) {
+	const kvnode** children;
+	size_t count;
+	size_t i;
+	bool result = true;
+	indent(out, depth);
+	fprintf(out, "\"%s\"", node->name);
+	if (node->value != NULL) {
+		fprintf(out, "\t\t\"%s\"", node->value);
+	}
+	if (node->conditional != NULL) {
+		fprintf(out, " %s", node->conditional);
+	}
+	fputc('\n', out);
+	if (node->value == NULL) {
+		children = effective(merger, node, &count);
+		if (children == NULL) {
+			return false;
+		}
+		indent(out, depth);
+		fputs("{\n", out);
+		for (i = 0; i < count && result; i++) {
+			result = kvdump(merger, out, children[i], depth + 1);
+		}
+		free(children);
+		indent(out, depth);
+		fputs("}\n", out);
+	}
+	return result;
+}
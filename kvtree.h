@@ -0,0 +1,160 @@
+/*
+ * kvtree.h - KeyValues trees with #base merging
+ *
+ * Copyright (c) 2015-2016 Sam Heybey
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef KVTREE_H
+#define KVTREE_H
+
+#include <stdio.h>
+
+#include "kvparse.h"
+
+/*
+ * nodes, their children and their strings all live in an arena and are
+ * never changed once built. a merged node is an overlay: it holds the
+ * node's own children, with those that base overrides replaced, and
+ * points to the base for everything else, so a base tree is never copied
+ * into the files that include it.
+ */
+typedef struct kvblock kvblock;
+
+typedef struct {
+	kvblock* blocks;
+} kvarena;
+
+typedef struct kvnode kvnode;
+
+struct kvnode {
+	const char* name;
+	const char* value;       //NULL for a subkey
+	const char* conditional; //NULL when there is none
+	const kvnode** children;
+	size_t count;
+	const kvnode* base;      //merged under children, NULL unless this is an overlay
+	uint32_t hash;           //of the lowercased name
+	int file;                //id given to the builder
+	int line;
+};
+
+void* kvalloc(kvarena* arena, size_t size);
+void kvarenafree(kvarena* arena);
+
+typedef struct {
+	const char* path; //argument of the directive
+	int line;
+} kvbase;
+
+/*
+ * builds a tree from parser events. #base directives are collected rather
+ * than added to the tree, since they only apply at the root.
+ */
+typedef struct {
+	kvarena* arena;
+	int file;
+	bool failed; //out of memory
+
+	//root keys in order, the first one is what #base files are merged into
+	const kvnode** roots;
+	size_t rootcount;
+	kvbase* bases;
+	size_t basecount;
+
+	//children read so far at each open level, and the subkey of each level
+	const kvnode** pending;
+	size_t pendingcount;
+	size_t pendingcapacity;
+	kvnode** open;
+	size_t* starts;
+	size_t depth;
+	size_t opencapacity;
+	size_t basecapacity;
+
+	const char* name;
+	int nameline;
+	const char* conditional;
+	bool directive;
+	kvnode* last;
+} kvbuilder;
+
+void kvbuildinit(kvbuilder* builder, kvarena* arena, int file);
+void kvbuildevent(kvbuilder* builder, const kvevent* event);
+
+/*
+ * close subkeys left open by a truncated file and fill in roots
+ */
+void kvbuildfinish(kvbuilder* builder);
+
+/*
+ * frees the builder's own bookkeeping; the tree stays in the arena
+ */
+void kvbuildfree(kvbuilder* builder);
+
+/*
+ * called when a key is a value on one side of a merge and a subkey on the
+ * other. the node is kept and the base is dropped.
+ */
+typedef void (*kvconflicthandler)(const kvnode* node, const kvnode* base, void* context);
+
+typedef struct {
+	const void* first;
+	const void* second;
+	const void* value; //NULL for an empty entry
+} kvmemoentry;
+
+typedef struct {
+	kvmemoentry* entries;
+	size_t count;
+	size_t capacity;
+} kvmemo;
+
+/*
+ * keeps the name tables of nodes merged in as a base and the combinations
+ * of #base files, so they are built once however many files use them
+ */
+typedef struct {
+	kvarena* arena;
+	kvconflicthandler conflict;
+	void* context;
+	kvmemo lookups; //by node
+	kvmemo chains;  //by the two bases combined
+} kvmerger;
+
+void kvmergerinit(kvmerger* merger, kvarena* arena, kvconflicthandler conflict, void* context);
+void kvmergerfree(kvmerger* merger);
+
+/*
+ * merge base under node the way KeyValues::RecursiveMergeKeyValues does:
+ * keys of node win, subkeys with the same name are merged and keys only
+ * in base are appended. names compare case insensitively. node may be
+ * NULL, for files that hold nothing but #base directives. returns NULL
+ * when out of memory.
+ */
+const kvnode* kvmerge(kvmerger* merger, const kvnode* node, const kvnode* base);
+
+/*
+ * returns false when out of memory
+ */
+bool kvdump(kvmerger* merger, FILE* out, const kvnode* node, int depth);
+
+#endif